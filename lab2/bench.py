@@ -0,0 +1,71 @@
+#!/usr/bin/python3
+
+# Measures the host cost per simulated instruction. Pass several simulator
+# binaries (e.g. a build before and after a change) to compare them side by
+# side:  python3 bench.py --sim ./sim.old ./sim -- inputs/long/*.x
+
+import sys, os, subprocess, re, glob, argparse, time
+
+bold="\033[1m"
+green="\033[0;32m"
+red="\033[0;31m"
+normal="\033[0m"
+
+
+def main():
+    all_inputs = sorted(glob.glob("inputs/long/*.x"))
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument("inputs", nargs="*", default=all_inputs)
+    parser.add_argument("--sim", nargs="+", default=["./sim"])
+    parser.add_argument("--repeat", type=int, default=3)
+    parser = parser.parse_args()
+
+    print("  " + "Input".ljust(28) + "Sim".ljust(16) + "Retired".rjust(12) +
+          "Host[s]".rjust(10) + "ns/inst".rjust(10) + "KIPS".rjust(10))
+
+    for i in parser.inputs:
+        if not os.path.exists(i):
+            print(red + "ERROR -- input file (*.x) not found: " + i + normal)
+            continue
+
+        base = None
+        for sim in parser.sim:
+            retired, seconds = run(sim, i, parser.repeat)
+            ns = seconds * 1e9 / max(retired, 1)
+            line = "  " + i.ljust(28) + sim.ljust(16) + str(retired).rjust(12) + \
+                   ("%.3f" % seconds).rjust(10) + ("%.1f" % ns).rjust(10) + \
+                   ("%.0f" % (retired / seconds / 1e3)).rjust(10)
+            if base is None:
+                base = ns
+            else:
+                color = green if ns <= base else red
+                line += color + ("  %+.1f%%" % ((ns - base) / base * 100)) + normal
+            print(line)
+        print()
+
+
+def run(sim, i, repeat):
+    cmds = b""
+    cmdfile = os.path.splitext(i)[0] + ".cmd"
+    if os.path.exists(cmdfile):
+      cmds += open(cmdfile).read().encode('utf-8')
+    cmds += b"\ngo\nrdump\nquit\n"
+
+    # best of N to filter out noise from the host
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        proc = subprocess.Popen([sim, i], executable=sim, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        (out, err) = proc.communicate(input=cmds)
+        elapsed = time.perf_counter() - start
+        if best is None or elapsed < best:
+            best = elapsed
+
+    m = re.search(r"^RetiredInstr: (\d+)", out.decode('utf-8'), re.M)
+    retired = int(m.group(1)) if m else 0
+    return retired, best
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,73 @@
+#!/usr/bin/python3
+
+# Packs a program in the text format (one hex word a line) into the binary
+# image the simulator maps straight into guest memory: a little-endian MIPS
+# ELF32 executable with the text at 0x00400000 and, optionally, initialized
+# data at 0x10000000. Segments are padded to the 64 KB guest pages so every
+# page can be used in place.
+#   python3 mkelf.py inputs/random/random1.x -o random1.elf
+#   python3 mkelf.py prog.x --data prog_data.x --bss 4096
+
+import sys, os, struct, argparse
+
+TEXT_START = 0x00400000
+DATA_START = 0x10000000
+PAGE_SIZE = 0x10000
+
+EM_MIPS = 8
+ET_EXEC = 2
+PT_LOAD = 1
+PF_X, PF_W, PF_R = 1, 2, 4
+
+
+def read_words(filename):
+    words = []
+    for line in open(filename):
+        line = line.strip()
+        if line:
+            words.append(int(line, 16) & 0xffffffff)
+    return struct.pack("<%dI" % len(words), *words)
+
+
+def pad(data, align):
+    return data + b"\0" * (-len(data) % align)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("program")
+    parser.add_argument("-o", "--output")
+    parser.add_argument("-d", "--data", help="initialized data, one hex word a line")
+    parser.add_argument("--bss", type=int, default=0, help="zeroed bytes after the data")
+    parser.add_argument("-e", "--entry", type=lambda x: int(x, 0), default=TEXT_START)
+    parser = parser.parse_args()
+
+    output = parser.output or os.path.splitext(parser.program)[0] + ".elf"
+
+    # (vaddr, bytes, memsz, flags)
+    segments = [(TEXT_START, read_words(parser.program), None, PF_R | PF_X)]
+    if parser.data or parser.bss:
+        data = read_words(parser.data) if parser.data else b""
+        segments.append((DATA_START, data, len(data) + parser.bss, PF_R | PF_W))
+
+    # headers on the first page, every segment starts on a page of its own
+    phoff = 52
+    offset = PAGE_SIZE
+    phdrs = b""
+    body = b""
+    for vaddr, data, memsz, flags in segments:
+        phdrs += struct.pack("<8I", PT_LOAD, offset, vaddr, vaddr, len(data),
+                             memsz if memsz is not None else len(data), flags, PAGE_SIZE)
+        body += pad(data, PAGE_SIZE)
+        offset += len(pad(data, PAGE_SIZE))
+
+    ident = b"\x7fELF" + bytes([1, 1, 1]) + b"\0" * 9  # 32-bit, little-endian
+    ehdr = ident + struct.pack("<HHIIIIIHHHHHH", ET_EXEC, EM_MIPS, 1, parser.entry,
+                               phoff, 0, 0, 52, 32, len(segments), 40, 0, 0)
+
+    with open(output, "wb") as f:
+        f.write(pad(ehdr + phdrs, PAGE_SIZE) + body)
+
+
+if __name__ == "__main__":
+    main()
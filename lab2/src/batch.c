@@ -0,0 +1,260 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "shell.h"
+#include "sim.h"
+
+#define BATCH_MAX_ARGS 64
+
+// The pool: workers take the next job to start, and whoever completes the
+// oldest unreported job reports it and the done ones after it
+typedef struct Batch_State {
+  Batch_Job *jobs;
+  int num_jobs;
+  Batch_Done_Fn done;
+  void *arg;
+
+  pthread_mutex_t lock;
+  /* next job to start and next job to report */
+  int next_job;
+  int next_done;
+} Batch_State;
+
+bool batch_parse_job(Batch_Job *job, const char *line, Sim_Options *options) {
+  char *save, *arg;
+  int argc = 0;
+
+  memset(job, 0, sizeof(Batch_Job));
+  job->line = strdup(line);
+  job->args = strdup(line);
+  job->argv = (char **)malloc(BATCH_MAX_ARGS * sizeof(char *));
+  for (arg = strtok_r(job->args, " \t", &save); arg != NULL;
+       arg = strtok_r(NULL, " \t", &save)) {
+    if (argc == BATCH_MAX_ARGS)
+      return false;
+    job->argv[argc++] = arg;
+  }
+
+  /* files written during the run would be shared by all the jobs running at
+   * once, so a job only writes the ones its own line names */
+  job->options = *options;
+  job->options.checkpoint_file = NULL;
+  job->options.stats_file = NULL;
+  job->options.profile_file = NULL;
+  job->options.trace_file = NULL;
+  job->options.timeline_file = NULL;
+  job->options.konata_file = NULL;
+  if (!parse_options(argc, job->argv, &job->options))
+    return false;
+  if (job->options.num_program_files == 0) {
+    job->options.program_files = options->program_files;
+    job->options.num_program_files = options->num_program_files;
+  }
+
+  /* no nested batches */
+  return job->options.num_program_files > 0 &&
+         job->options.batch_file == options->batch_file &&
+         job->options.regress_reference == options->regress_reference;
+}
+
+void batch_free_job(Batch_Job *job) {
+  free(job->line);
+  free(job->args);
+  free(job->argv);
+  free(job->output);
+}
+
+static bool batch_read_jobs(Batch_Job **jobs, int *num_jobs,
+                            const char *jobs_file, Sim_Options *options) {
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  int line_no = 0, max_jobs = 0;
+
+  FILE *f = fopen(jobs_file, "r");
+  if (f == NULL) {
+    printf("Error: Can't open jobs file %s\n", jobs_file);
+    return false;
+  }
+
+  while ((len = getline(&line, &line_size, f)) != -1) {
+    line_no++;
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    /* skip blank lines and comments */
+    if (line[strspn(line, " \t")] == '\0' || line[strspn(line, " \t")] == '#')
+      continue;
+
+    if (*num_jobs == max_jobs) {
+      max_jobs = max_jobs ? 2 * max_jobs : 64;
+      *jobs = realloc(*jobs, max_jobs * sizeof(Batch_Job));
+    }
+    Batch_Job *job = *jobs + (*num_jobs)++;
+    if (!batch_parse_job(job, line, options)) {
+      printf("Error: bad job on line %d of %s: %s\n", line_no, jobs_file,
+             job->line);
+      free(line);
+      fclose(f);
+      return false;
+    }
+  }
+
+  free(line);
+  fclose(f);
+  return true;
+}
+
+static double batch_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void batch_simulate(Batch_Job *job, FILE *out) {
+  Sim_Context *ctx = sim_context_create(out);
+  sim_context_bind(ctx);
+
+  if (start_simulation(&job->options) &&
+      (job->options.command_file == NULL ||
+       run_command_file(job->options.command_file))) {
+    go();
+    rdump();
+    finish_simulation();
+  } else {
+    job->failed = true;
+  }
+
+  sim_context_free(ctx);
+}
+
+// The external simulator gets the program files and the commands on stdin,
+// like an interactive session; other options are not passed on
+static void batch_simulate_external(Batch_Job *job, FILE *out) {
+  char *cmd;
+  size_t cmd_size;
+  FILE *sh = open_memstream(&cmd, &cmd_size);
+
+  fprintf(sh, "(");
+  if (job->options.command_file)
+    fprintf(sh, "cat '%s'; ", job->options.command_file);
+  fprintf(sh, "printf '\\ngo\\nrdump\\nquit\\n') | '%s'", job->external);
+  for (int i = 0; i < job->options.num_program_files; ++i)
+    fprintf(sh, " '%s'", job->options.program_files[i]);
+  fprintf(sh, " 2>&1");
+  fclose(sh);
+
+  FILE *p = popen(cmd, "r");
+  if (p == NULL) {
+    fprintf(out, "Error: can't run %s\n", job->external);
+  } else {
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), p)) > 0)
+      fwrite(buffer, 1, n, out);
+    if (pclose(p) != 0)
+      fprintf(out, "Error: %s failed\n", job->external);
+  }
+  free(cmd);
+}
+
+static void batch_run_job(Batch_Job *job) {
+  FILE *out = open_memstream(&job->output, &job->output_size);
+  if (out == NULL) {
+    printf("Error: out of memory for the output of %s\n", job->line);
+    exit(-1);
+  }
+
+  double start = batch_now();
+  if (job->external)
+    batch_simulate_external(job, out);
+  else
+    batch_simulate(job, out);
+  job->host_seconds = batch_now() - start;
+
+  fclose(out);
+}
+
+static void *batch_worker(void *arg) {
+  Batch_State *b = (Batch_State *)arg;
+
+  while (1) {
+    pthread_mutex_lock(&b->lock);
+    int i = b->next_job++;
+    pthread_mutex_unlock(&b->lock);
+    if (i >= b->num_jobs)
+      return NULL;
+
+    batch_run_job(b->jobs + i);
+
+    pthread_mutex_lock(&b->lock);
+    b->jobs[i].done = true;
+    while (b->next_done < b->num_jobs && b->jobs[b->next_done].done) {
+      Batch_Job *job = b->jobs + b->next_done++;
+      if (b->done)
+        b->done(job, b->arg);
+    }
+    pthread_mutex_unlock(&b->lock);
+  }
+}
+
+void batch_run_jobs(Batch_Job *jobs, int num_jobs, int num_threads,
+                    Batch_Done_Fn done, void *arg) {
+  Batch_State b;
+
+  memset(&b, 0, sizeof(b));
+  b.jobs = jobs;
+  b.num_jobs = num_jobs;
+  b.done = done;
+  b.arg = arg;
+
+  if (num_threads <= 0)
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads > num_jobs)
+    num_threads = num_jobs;
+
+  pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  pthread_mutex_init(&b.lock, NULL);
+  for (int i = 0; i < num_threads; ++i) {
+    if (pthread_create(threads + i, NULL, batch_worker, &b) != 0) {
+      printf("Error: can't start batch thread\n");
+      exit(-1);
+    }
+  }
+  for (int i = 0; i < num_threads; ++i)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&b.lock);
+
+  free(threads);
+}
+
+static void batch_print_job(Batch_Job *job, void *arg) {
+  (void)arg;
+  printf("==> %s <==\n", job->line);
+  fwrite(job->output, 1, job->output_size, stdout);
+  printf("\n");
+  fflush(stdout);
+
+  /* printed outputs are not needed anymore */
+  free(job->output);
+  job->output = NULL;
+}
+
+bool batch_run(const char *jobs_file, Sim_Options *options) {
+  Batch_Job *jobs = NULL;
+  int num_jobs = 0;
+  bool ok = batch_read_jobs(&jobs, &num_jobs, jobs_file, options);
+
+  if (ok)
+    batch_run_jobs(jobs, num_jobs, options->batch_threads, batch_print_job,
+                   NULL);
+
+  for (int i = 0; i < num_jobs; ++i)
+    batch_free_job(jobs + i);
+  free(jobs);
+  return ok;
+}
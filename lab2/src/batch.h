@@ -0,0 +1,50 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "shell.h"
+
+// One simulation of a batch. It runs in a context of its own, or in a child
+// process when it names an external simulator binary (e.g. the reference)
+typedef struct Batch_Job {
+  /* the job line as given, and its tokens (options point into them) */
+  char *line;
+  char *args;
+  char **argv;
+  Sim_Options options;
+
+  /* simulator binary to run instead, NULL to simulate in this process */
+  const char *external;
+
+  /* everything the simulation printed and how long it took on the host */
+  char *output;
+  size_t output_size;
+  double host_seconds;
+  bool done;
+  /* the simulation never ran: a program, checkpoint or command file failed */
+  bool failed;
+} Batch_Job;
+
+/* called in job order, once a job and all jobs before it are done */
+typedef void (*Batch_Done_Fn)(Batch_Job *job, void *arg);
+
+/* set up a job from "[options] <program files>" on top of the given options,
+ * except for the output files (-C, -s, -H, -t, -J, -K); without program files
+ * the job runs the ones in options */
+bool batch_parse_job(Batch_Job *job, const char *line, Sim_Options *options);
+
+/* release a job's line, tokens and output */
+void batch_free_job(Batch_Job *job);
+
+/* run jobs on num_threads threads (0 for one per host cpu); each job runs
+ * its command file (-c) if any, then go and rdump */
+void batch_run_jobs(Batch_Job *jobs, int num_jobs, int num_threads,
+                    Batch_Done_Fn done, void *arg);
+
+/* Run every job in jobs_file, one per line, and print the outputs in job
+ * order. Returns false if the jobs file can't be read or has a bad job. */
+bool batch_run(const char *jobs_file, Sim_Options *options);
+
+#endif
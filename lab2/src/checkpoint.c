@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "memory.h"
+#include "pipe.h"
+#include "shell.h"
+#include "sim.h"
+
+#define CHECKPOINT_MAGIC "MIPSCKPT"
+#define CHECKPOINT_VERSION 9
+
+// The header identifies the format and the layout of the raw structs inside,
+// a checkpoint can only be restored by a build with the same layout
+typedef struct Checkpoint_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t pipe_op_size;
+  uint32_t cache_block_size;
+  uint32_t memory_request_size;
+} Checkpoint_Header;
+
+static Checkpoint_Header checkpoint_header() {
+  Checkpoint_Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.version = CHECKPOINT_VERSION;
+  h.pipe_op_size = sizeof(Pipe_Op);
+  h.cache_block_size = sizeof(L1_Cache_Block);
+  h.memory_request_size = sizeof(Memory_Request);
+  return h;
+}
+
+void checkpoint_write(Checkpoint *ck, const void *p, size_t size) {
+  if (fwrite(p, 1, size, ck->file) != size) {
+    printf("Error: can't write checkpoint\n");
+    exit(-1);
+  }
+  ck->pos += size;
+}
+
+void checkpoint_read(Checkpoint *ck, void *p, size_t size) {
+  memcpy(p, checkpoint_read_mapped(ck, size), size);
+}
+
+uint8_t *checkpoint_read_mapped(Checkpoint *ck, size_t size) {
+  // a short file leaves the simulator half restored, nothing to recover
+  if (ck->pos + size > ck->size) {
+    printf("Error: checkpoint is truncated\n");
+    exit(-1);
+  }
+  uint8_t *p = ck->data + ck->pos;
+  ck->pos += size;
+  return p;
+}
+
+void checkpoint_align(Checkpoint *ck, size_t align) {
+  static const uint8_t zero[64] = {0};
+  size_t pad = (align - ck->pos % align) % align;
+
+  if (ck->file == NULL) {
+    checkpoint_read_mapped(ck, pad);
+    return;
+  }
+  while (pad > 0) {
+    size_t n = pad < sizeof(zero) ? pad : sizeof(zero);
+    checkpoint_write(ck, zero, n);
+    pad -= n;
+  }
+}
+
+static int checkpoint_l1_id(L1_Cache_State *l1) {
+  return l1 == &sim->inst_cache ? 0 : 1;
+}
+
+// The first reference to a block carries its contents, later ones only the
+// index, -1 stands for NULL
+void checkpoint_write_block(Checkpoint *ck, Cache_Block *b) {
+  int32_t id = -1;
+
+  if (b != NULL) {
+    for (id = 0; id < ck->num_blocks; ++id) {
+      if (ck->blocks[id] == b)
+        break;
+    }
+  }
+  checkpoint_write_value(ck, id);
+
+  if (b == NULL || id < ck->num_blocks)
+    return;
+
+  if (ck->num_blocks == ck->max_blocks) {
+    ck->max_blocks = ck->max_blocks ? 2 * ck->max_blocks : 64;
+    ck->blocks = realloc(ck->blocks, ck->max_blocks * sizeof(Cache_Block *));
+  }
+  ck->blocks[ck->num_blocks++] = b;
+
+  int32_t l1 = checkpoint_l1_id(b->l1);
+  checkpoint_write_value(ck, b->tag);
+  checkpoint_write_value(ck, l1);
+  checkpoint_write_value(ck, b->pc);
+}
+
+Cache_Block *checkpoint_read_block(Checkpoint *ck) {
+  int32_t id, l1;
+
+  checkpoint_read_value(ck, id);
+  if (id < 0)
+    return NULL;
+  if (id < ck->num_blocks)
+    return ck->blocks[id];
+  if (id != ck->num_blocks) {
+    printf("Error: checkpoint is corrupt\n");
+    exit(-1);
+  }
+
+  Cache_Block *b = (Cache_Block *)malloc(sizeof(Cache_Block));
+  checkpoint_read_value(ck, b->tag);
+  checkpoint_read_value(ck, l1);
+  checkpoint_read_value(ck, b->pc);
+  b->l1 = l1 == 0 ? &sim->inst_cache : &sim->data_cache;
+
+  if (ck->num_blocks == ck->max_blocks) {
+    ck->max_blocks = ck->max_blocks ? 2 * ck->max_blocks : 64;
+    ck->blocks = realloc(ck->blocks, ck->max_blocks * sizeof(Cache_Block *));
+  }
+  ck->blocks[ck->num_blocks++] = b;
+  return b;
+}
+
+static void checkpoint_stats(Checkpoint *ck, bool save) {
+  uint32_t *stats[] = {&sim->stat_cycles,
+                       &sim->stat_inst_retire,
+                       &sim->stat_inst_fetch,
+                       &sim->stat_squash,
+                       &sim->stat_inst_ffwd,
+                       &sim->stat_inst_cache_hits,
+                       &sim->stat_inst_cache_misses,
+                       &sim->stat_data_cache_hits,
+                       &sim->stat_data_cache_misses};
+
+  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); ++i) {
+    if (save)
+      checkpoint_write(ck, stats[i], sizeof(uint32_t));
+    else
+      checkpoint_read(ck, stats[i], sizeof(uint32_t));
+  }
+
+  /* the registry counts the same cycles as the counters above */
+  if (save)
+    stats_save(&sim->stats, ck);
+  else
+    stats_restore(&sim->stats, ck);
+}
+
+bool checkpoint_save(const char *filename) {
+  Checkpoint ck;
+  memset(&ck, 0, sizeof(ck));
+
+  /* a halted pipeline has already released the memory hierarchy */
+  if (sim->RUN_BIT == FALSE) {
+    fprintf(sim->out, "Error: can't checkpoint a halted simulator\n");
+    return false;
+  }
+
+  ck.file = fopen(filename, "wb");
+  if (ck.file == NULL) {
+    fprintf(sim->out, "Error: can't open checkpoint file %s\n", filename);
+    return false;
+  }
+
+  Checkpoint_Header h = checkpoint_header();
+  checkpoint_write_value(&ck, h);
+  checkpoint_stats(&ck, true);
+  pipe_save(&ck);
+  mem_save(&ck);
+
+  free(ck.blocks);
+  if (fclose(ck.file) != 0) {
+    fprintf(sim->out, "Error: can't write checkpoint file %s\n", filename);
+    return false;
+  }
+  return true;
+}
+
+bool checkpoint_restore(const char *filename) {
+  Checkpoint ck;
+  struct stat st;
+  Checkpoint_Header h, expected = checkpoint_header();
+  memset(&ck, 0, sizeof(ck));
+
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL) {
+    fprintf(sim->out, "Error: can't open checkpoint file %s\n", filename);
+    return false;
+  }
+  if (fstat(fileno(file), &st) != 0 || (size_t)st.st_size < sizeof(h)) {
+    fprintf(sim->out, "Error: %s is not a checkpoint\n", filename);
+    fclose(file);
+    return false;
+  }
+
+  /* private mapping: guest pages are copied only once they get written */
+  ck.size = st.st_size;
+  ck.data = mmap(NULL, ck.size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fileno(file), 0);
+  fclose(file);
+  if (ck.data == MAP_FAILED) {
+    fprintf(sim->out, "Error: can't map checkpoint file %s\n", filename);
+    return false;
+  }
+
+  checkpoint_read_value(&ck, h);
+  if (memcmp(&h, &expected, sizeof(h)) != 0) {
+    fprintf(sim->out,
+            "Error: %s is not a checkpoint of this simulator build\n",
+            filename);
+    munmap(ck.data, ck.size);
+    return false;
+  }
+
+  checkpoint_stats(&ck, false);
+  pipe_restore(&ck);
+  /* guest memory keeps using the mapping from now on */
+  mem_restore(&ck);
+
+  free(ck.blocks);
+  sim->RUN_BIT = TRUE;
+  return true;
+}
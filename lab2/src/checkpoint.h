@@ -0,0 +1,55 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdio.h>
+
+#include "common.h"
+
+/*
+ * A checkpoint is a binary image of the complete simulator state: pipeline,
+ * guest memory, caches, MSHRs, DRAM queues, interconnect messages and stats.
+ * Components serialize themselves in a fixed order through the primitives
+ * below. On restore the file is memory-mapped (copy-on-write) and guest pages
+ * are used in place, so restoring a large warmed-up state is cheap.
+ *
+ * Cache blocks in flight are shared between L2 MSHRs, interconnect messages
+ * and memory requests; they are written once and referenced by index so the
+ * sharing survives a restore.
+ */
+struct Checkpoint {
+  /* file being written (save) */
+  FILE *file;
+  /* mapped file and read cursor (restore) */
+  uint8_t *data;
+  size_t size;
+  /* bytes written or read so far */
+  size_t pos;
+  /* cache blocks seen so far, the index is the on-disk reference */
+  Cache_Block **blocks;
+  int num_blocks;
+  int max_blocks;
+};
+
+/* write the simulator state to filename, false on error */
+bool checkpoint_save(const char *filename);
+
+/* replace the simulator state by the one in filename, false on error */
+bool checkpoint_restore(const char *filename);
+
+/* raw data */
+void checkpoint_write(Checkpoint *ck, const void *p, size_t size);
+void checkpoint_read(Checkpoint *ck, void *p, size_t size);
+#define checkpoint_write_value(ck, v) checkpoint_write((ck), &(v), sizeof(v))
+#define checkpoint_read_value(ck, v) checkpoint_read((ck), &(v), sizeof(v))
+
+/* reference to a cache block in flight (may be NULL) */
+void checkpoint_write_block(Checkpoint *ck, Cache_Block *b);
+Cache_Block *checkpoint_read_block(Checkpoint *ck);
+
+/* pad (save) or skip (restore) to a multiple of align */
+void checkpoint_align(Checkpoint *ck, size_t align);
+
+/* pointer to the next size bytes inside the mapped file (restore) */
+uint8_t *checkpoint_read_mapped(Checkpoint *ck, size_t size);
+
+#endif
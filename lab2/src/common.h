@@ -24,6 +24,15 @@
 typedef struct L1_Cache_State L1_Cache_State;
 typedef struct L2_Cache_State L2_Cache_State;
 typedef struct Memory_State Memory_State;
+typedef struct Checkpoint Checkpoint;
+typedef struct Stat Stat;
+typedef struct Stats Stats;
+typedef struct Profile Profile;
+typedef struct Trace Trace;
+typedef struct Timeline Timeline;
+typedef struct Konata Konata;
+typedef struct Host_Profile Host_Profile;
+typedef struct Event_Queue Event_Queue;
 
 /* generic cache block to passed around the memory hierarchy */
 typedef struct Cache_Block {
@@ -31,6 +40,8 @@ typedef struct Cache_Block {
   uint32_t tag;
   /* ptr to data or instruction cache */
   L1_Cache_State *l1;
+  /* PC of the instruction whose L1 miss requested the block */
+  uint32_t pc;
 } Cache_Block;
 
 #endif
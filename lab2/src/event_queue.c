@@ -0,0 +1,108 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include "event_queue.h"
+
+void event_queue_init(Event_Queue *q) {
+  q->max_events = EVENT_QUEUE_INITIAL_SIZE;
+  q->heap = (Event *)malloc(q->max_events * sizeof(Event));
+  q->num_events = 0;
+  q->now = 0;
+  q->next_seq = 0;
+}
+
+void event_queue_free(Event_Queue *q) {
+  free(q->heap);
+  q->heap = NULL;
+  q->num_events = q->max_events = 0;
+}
+
+static bool event_before(Event *a, Event *b) {
+  if (a->cycle != b->cycle)
+    return a->cycle < b->cycle;
+  if (a->priority != b->priority)
+    return a->priority < b->priority;
+  return a->seq < b->seq;
+}
+
+void event_schedule(Event_Queue *q, uint64_t delay, Event_Priority priority,
+                    Event_Fn fn, void *arg, void *data) {
+  if (q->num_events == q->max_events) {
+    q->max_events *= 2;
+    q->heap = (Event *)realloc(q->heap, q->max_events * sizeof(Event));
+  }
+
+  Event e = {q->now + delay, priority, q->next_seq++, fn, arg, data};
+
+  /* sift up */
+  int n = q->num_events++;
+  while (n > 0) {
+    int parent = (n - 1) / 2;
+    if (!event_before(&e, q->heap + parent))
+      break;
+    q->heap[n] = q->heap[parent];
+    n = parent;
+  }
+  q->heap[n] = e;
+}
+
+static Event event_pop(Event_Queue *q) {
+  Event top = q->heap[0];
+  Event last = q->heap[--q->num_events];
+
+  /* sift the last event down from the root */
+  int n = 0;
+  for (;;) {
+    int child = 2 * n + 1;
+    if (child >= q->num_events)
+      break;
+    if (child + 1 < q->num_events &&
+        event_before(q->heap + child + 1, q->heap + child))
+      child++;
+    if (!event_before(q->heap + child, &last))
+      break;
+    q->heap[n] = q->heap[child];
+    n = child;
+  }
+  if (q->num_events)
+    q->heap[n] = last;
+  return top;
+}
+
+void event_run(Event_Queue *q) {
+  while (q->num_events && q->heap[0].cycle <= q->now) {
+    Event e = event_pop(q);
+    e.fn(e.arg, e.data);
+  }
+}
+
+int event_idle_cycles(Event_Queue *q) {
+  if (q->num_events == 0)
+    return INT_MAX;
+  if (q->heap[0].cycle <= q->now)
+    return 0;
+
+  uint64_t idle = q->heap[0].cycle - q->now;
+  return idle < INT_MAX ? (int)idle : INT_MAX;
+}
+
+void event_advance(Event_Queue *q, int n) {
+  assert(n <= event_idle_cycles(q));
+  q->now += n;
+}
+
+static int event_compare(const void *a, const void *b) {
+  return event_before((Event *)a, (Event *)b) ? -1 : 1;
+}
+
+int event_queue_find(Event_Queue *q, void *arg, Event *events) {
+  int found = 0;
+
+  for (int n = 0; n < q->num_events; ++n) {
+    if (q->heap[n].arg == arg)
+      events[found++] = q->heap[n];
+  }
+  qsort(events, found, sizeof(Event), event_compare);
+  return found;
+}
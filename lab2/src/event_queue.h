@@ -0,0 +1,81 @@
+/*
+ * Discrete-event kernel
+ *
+ * Components that model a delay schedule a callback for the cycle in which
+ * the delay is over instead of counting it down every cycle: the interconnect
+ * delivers each message through an event, DRAM retires each request through
+ * one. Events live in a binary heap ordered by (cycle, priority, sequence):
+ * within a cycle lower priorities run first, and events of the same priority
+ * run in the order they were scheduled.
+ *
+ * The kernel keeps its own clock, now, which is the cycle pipe_cycle
+ * simulates next. pipe_cycle runs the events due in its cycle before it ticks
+ * the rest of the machine, and skipping idle cycles (-f) jumps the clock
+ * straight to the next event. Cycles are only ever stored relative to now,
+ * e.g. in checkpoints.
+ */
+
+#ifndef _EVENT_QUEUE_H_
+#define _EVENT_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* initial number of events in the heap, it doubles when full */
+#define EVENT_QUEUE_INITIAL_SIZE 64
+
+/* order of the events due in the same cycle */
+typedef enum Event_Priority {
+  EVENT_INTERCONNECT, /* message delivery */
+  EVENT_DRAM          /* DRAM request done */
+} Event_Priority;
+
+typedef void (*Event_Fn)(void *arg, void *data);
+
+typedef struct Event {
+  uint64_t cycle;
+  Event_Priority priority;
+  uint64_t seq;
+  /* called as fn(arg, data); arg is the component, data what it is about */
+  Event_Fn fn;
+  void *arg;
+  void *data;
+} Event;
+
+struct Event_Queue {
+  /* binary min-heap of the scheduled events */
+  Event *heap;
+  int num_events;
+  int max_events;
+  /* cycle simulated next, and the sequence number of the next event */
+  uint64_t now;
+  uint64_t next_seq;
+};
+
+/* an empty queue at cycle 0 */
+void event_queue_init(Event_Queue *q);
+
+/* drop all events without running them */
+void event_queue_free(Event_Queue *q);
+
+/* run fn(arg, data) delay cycles from now (0 for later in the current one) */
+void event_schedule(Event_Queue *q, uint64_t delay, Event_Priority priority,
+                    Event_Fn fn, void *arg, void *data);
+
+/* run the events due in the current cycle, including those they schedule
+ * for it */
+void event_run(Event_Queue *q);
+
+/* number of cycles from now on without any event, INT_MAX if there is none */
+int event_idle_cycles(Event_Queue *q);
+
+/* move on by n cycles, which must not skip any event */
+void event_advance(Event_Queue *q, int n);
+
+/* copy the events for component arg, in the order they run, into events
+ * (which holds at least q->num_events) and return how many there are */
+int event_queue_find(Event_Queue *q, void *arg, Event *events);
+
+#endif
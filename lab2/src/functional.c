@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "functional.h"
+#include "l1_cache.h"
+#include "pipe.h"
+#include "shell.h"
+#include "sim.h"
+
+uint32_t functional_run(uint32_t max_insts, bool stop_at_pc, uint32_t stop_pc,
+                        bool warm)
+{
+  uint32_t executed = 0;
+  Pipe_Op op;
+
+  /* restart from the oldest op that has not retired yet */
+  pipe_squash_all();
+
+  while (sim->RUN_BIT && executed < max_insts)
+  {
+    if (stop_at_pc && sim->pipe.PC == stop_pc)
+      break;
+
+    memset(&op, 0, sizeof(Pipe_Op));
+    op.reg_src1 = op.reg_src2 = op.reg_dst = -1;
+    op.pc = sim->pipe.PC;
+    op.instruction = mem_read_32(sim->pipe.PC);
+    if (warm)
+      l1_cache_warm(&sim->inst_cache, sim->pipe.PC);
+
+    pipe_op_decode(&op);
+
+    /* no bypassing needed, every older op has already retired */
+    if (op.reg_src1 != -1)
+      op.reg_src1_value = op.reg_src1 == 0 ? 0 : sim->pipe.REGS[op.reg_src1];
+    if (op.reg_src2 != -1)
+      op.reg_src2_value = op.reg_src2 == 0 ? 0 : sim->pipe.REGS[op.reg_src2];
+
+    /* results are ready at once, HI/LO never stall */
+    sim->pipe.multiplier_stall = 0;
+    pipe_op_execute(&op);
+
+    if (op.is_mem)
+    {
+      if (warm)
+        l1_cache_warm(&sim->data_cache, op.mem_addr);
+      pipe_op_mem(&op);
+    }
+
+    /* branches redirect right away, there are no delay slots */
+    sim->pipe.PC = op.branch_taken ? op.branch_dest : op.pc + 4;
+
+    /* may halt the machine and set the final PC */
+    pipe_op_retire(&op);
+
+    executed++;
+  }
+
+  sim->stat_inst_ffwd += executed;
+  return executed;
+}
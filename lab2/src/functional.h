@@ -0,0 +1,24 @@
+/*
+ * Functional (instruction level) execution engine
+ *
+ * Executes instructions one at a time on the architectural state in
+ * Pipe_State and guest memory without modelling any timing. Used to
+ * fast-forward over e.g. the initialization phase of a long workload before
+ * the detailed pipeline takes over.
+ */
+
+#ifndef _FUNCTIONAL_H_
+#define _FUNCTIONAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Run up to max_insts instructions, stopping early at the halt syscall or,
+ * if stop_at_pc is set, before the instruction at stop_pc. Ops in flight in
+ * the pipeline are squashed first and re-executed functionally. With warm
+ * set, instruction and data accesses fill the L1/L2 tag arrays. Returns the
+ * number of instructions executed. */
+uint32_t functional_run(uint32_t max_insts, bool stop_at_pc, uint32_t stop_pc,
+                        bool warm);
+
+#endif
@@ -0,0 +1,51 @@
+#include "host_profile.h"
+
+static const char *host_component_names[HOST_NUM_COMPONENTS] = {
+    "interconnect", "dram", "l2", "wb", "mem",
+    "execute", "decode", "fetch", "other"};
+
+/* reads of the clock taken to measure its cost */
+#define HOST_CALIBRATION_READS 1000
+
+void host_profile_init(Host_Profile *h, Stats *stats, uint32_t interval) {
+  char name[32];
+
+  h->interval = h->countdown = interval;
+
+  /* the fastest back-to-back reads are the cost without any noise */
+  h->overhead = UINT64_MAX;
+  for (int n = 0; n < HOST_CALIBRATION_READS; ++n) {
+    uint64_t start = host_profile_now();
+    uint64_t ns = host_profile_now() - start;
+    if (ns < h->overhead)
+      h->overhead = ns;
+  }
+
+  for (int c = 0; c < HOST_NUM_COMPONENTS; ++c) {
+    snprintf(name, sizeof(name), "%s_ns", host_component_names[c]);
+    h->stat_ns[c] = stats_counter(stats, "host", name);
+  }
+  h->stat_cycles = stats_counter(stats, "host", "timed_cycles");
+}
+
+void host_profile_report(Host_Profile *h, FILE *out) {
+  uint64_t cycles = h->stat_cycles->value, total = 0;
+
+  for (int c = 0; c < HOST_NUM_COMPONENTS; ++c)
+    total += h->stat_ns[c]->value;
+
+  fprintf(out,
+          "Host time: %llu cycles timed (1 in %u), %.1f ns per cycle, "
+          "%llu ns per clock read taken off\n",
+          (unsigned long long)cycles, h->interval,
+          cycles ? (double)total / cycles : 0.0,
+          (unsigned long long)h->overhead);
+  fprintf(out, "  %-12s %10s %7s\n", "", "ns/cycle", "share");
+  for (int c = 0; c < HOST_NUM_COMPONENTS; ++c) {
+    uint64_t ns = h->stat_ns[c]->value;
+    fprintf(out, "  %-12s %10.1f %6.1f%%\n", host_component_names[c],
+            cycles ? (double)ns / cycles : 0.0,
+            total ? 100.0 * ns / total : 0.0);
+  }
+  fprintf(out, "\n");
+}
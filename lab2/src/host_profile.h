@@ -0,0 +1,86 @@
+/*
+ * Host-time profile
+ *
+ * Measures where the host spends its time within pipe_cycle: the
+ * interconnect, DRAM and L2 cycles, each pipeline stage, and the rest of the
+ * cycle (branch recovery and the per-cycle logs). Only one cycle in every
+ * interval is timed, with clock_gettime around each part, which keeps the
+ * overhead low; the report scales the timed cycles to ns per cycle. The cost
+ * of reading the clock is measured once and taken off every part, so that
+ * parts that do little do not look expensive. Cycles skipped with -f are not
+ * timed.
+ *
+ * The sums go into the stats registry as the "host" group, so stat dumps
+ * carry them next to the simulated stats.
+ */
+
+#ifndef _HOST_PROFILE_H_
+#define _HOST_PROFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "common.h"
+#include "stats.h"
+
+typedef enum Host_Component {
+  HOST_INTERCONNECT,
+  HOST_DRAM,
+  HOST_L2,
+  HOST_WB,
+  HOST_MEM,
+  HOST_EXECUTE,
+  HOST_DECODE,
+  HOST_FETCH,
+  HOST_OTHER,
+  HOST_NUM_COMPONENTS
+} Host_Component;
+
+struct Host_Profile {
+  /* time one cycle in interval, 0 when the profile is off */
+  uint32_t interval;
+  uint32_t countdown;
+  /* ns it takes to read the clock */
+  uint64_t overhead;
+  /* ns spent in each component and the number of timed cycles */
+  Stat *stat_ns[HOST_NUM_COMPONENTS];
+  Stat *stat_cycles;
+};
+
+/* time one cycle in every interval from now on, registers the "host" stats */
+void host_profile_init(Host_Profile *h, Stats *stats, uint32_t interval);
+
+/* true if the cycle that starts now gets timed */
+static inline bool host_profile_sample(Host_Profile *h) {
+  if (h->interval == 0 || --h->countdown)
+    return false;
+
+  h->countdown = h->interval;
+  stat_inc(h->stat_cycles);
+  return true;
+}
+
+static inline uint64_t host_profile_now() {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* charge the time since since to component, returns the time now */
+static inline uint64_t host_profile_charge(Host_Profile *h,
+                                           Host_Component component,
+                                           uint64_t since) {
+  uint64_t now = host_profile_now();
+
+  if (now - since > h->overhead)
+    stat_add(h->stat_ns[component], now - since - h->overhead);
+  return now;
+}
+
+/* print ns per timed cycle and the share of each component */
+void host_profile_report(Host_Profile *h, FILE *out);
+
+#endif
@@ -2,12 +2,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "checkpoint.h"
+#include "event_queue.h"
 #include "interconnect.h"
 #include "l1_cache.h"
 #include "l2_cache.h"
 #include "memory.h"
+#include "stats.h"
+#include "trace.h"
 
-// The message direction for the passing of cache block requests direction
+// The message direction for the passing of cache block requests direction, the
+// values are part of the trace format
 typedef enum Message_Direction
 {
   MSG_L2_TO_L1,
@@ -15,90 +20,148 @@ typedef enum Message_Direction
   MSG_MEM_TO_L2
 } Message_Direction;
 
-typedef struct Message
-{
-  Cache_Block *b;
-  // the time needed for this certain message to be processed
-  int cycles;
-  Message_Direction dir;
-} Message;
-
 void interconnect_init(Interconnect_State *i, L2_Cache_State *l2,
-                       Memory_State *m)
+                       Memory_State *m, Event_Queue *events, Stats *stats,
+                       Trace *trace)
 {
-  // Uses a list to store the messages
-  i->messages = list_new();
+  // Messages are events on the queue of the whole simulator
+  i->events = events;
+  i->num_messages = 0;
   i->l2 = l2;
   i->m = m;
+
+  // messages sent in each direction, and how many are on the way per cycle
+  i->stat_l2_to_l1 = stats_counter(stats, "interconnect", "l2_to_l1");
+  i->stat_l2_to_mem = stats_counter(stats, "interconnect", "l2_to_mem");
+  i->stat_mem_to_l2 = stats_counter(stats, "interconnect", "mem_to_l2");
+  i->stat_in_flight = stats_average(stats, "interconnect", "in_flight");
+  i->trace = trace;
+}
+
+// Delivery of a message, one callback per direction
+static void interconnect_deliver(Interconnect_State *i, Cache_Block *b,
+                                 Message_Direction dir)
+{
+  trace_event(i->trace, TRACE_INT, TRACE_INT_DELIVER, b->tag, dir);
+  i->num_messages--;
+  // determine what kind of message this is
+  switch (dir)
+  {
+  case MSG_L2_TO_L1:
+    l1_insert_block(b);
+    break;
+  case MSG_L2_TO_MEM:
+    memory_add_request(i->m, b);
+    break;
+  case MSG_MEM_TO_L2:
+    l2_insert_block(i->l2, b);
+    break;
+  }
+}
+
+static void interconnect_deliver_l2_to_l1(void *i, void *b)
+{
+  interconnect_deliver((Interconnect_State *)i, (Cache_Block *)b,
+                       MSG_L2_TO_L1);
+}
+
+static void interconnect_deliver_l2_to_mem(void *i, void *b)
+{
+  interconnect_deliver((Interconnect_State *)i, (Cache_Block *)b,
+                       MSG_L2_TO_MEM);
+}
+
+static void interconnect_deliver_mem_to_l2(void *i, void *b)
+{
+  interconnect_deliver((Interconnect_State *)i, (Cache_Block *)b,
+                       MSG_MEM_TO_L2);
+}
+
+static const Event_Fn interconnect_deliver_fns[] = {
+    interconnect_deliver_l2_to_l1, interconnect_deliver_l2_to_mem,
+    interconnect_deliver_mem_to_l2};
+
+// Messages are written in delivery order, each with the number of cycles it
+// waits before the one it is delivered in
+void interconnect_save(Interconnect_State *i, Checkpoint *ck)
+{
+  unsigned int len = i->num_messages;
+  checkpoint_write_value(ck, len);
+
+  Event *events = (Event *)malloc((i->events->num_events + 1) * sizeof(Event));
+  int num_events = event_queue_find(i->events, i, events);
+  assert(num_events == i->num_messages);
+
+  for (int n = 0; n < num_events; ++n)
+  {
+    Message_Direction dir = MSG_L2_TO_L1;
+    while (interconnect_deliver_fns[dir] != events[n].fn)
+      dir++;
+    int cycles = events[n].cycle - i->events->now;
+    checkpoint_write_block(ck, (Cache_Block *)events[n].data);
+    checkpoint_write_value(ck, cycles);
+    checkpoint_write_value(ck, dir);
+  }
+  free(events);
 }
 
-void interconnect_free(Interconnect_State *i)
+// expects a freshly initialized (empty) interconnect
+void interconnect_restore(Interconnect_State *i, Checkpoint *ck)
 {
-  list_node_t *node;
-  list_iterator_t *it = list_iterator_new(i->messages, LIST_HEAD);
-  while ((node = list_iterator_next(it)))
+  unsigned int len;
+  checkpoint_read_value(ck, len);
+
+  for (unsigned int n = 0; n < len; ++n)
   {
-    free(node->val);
-    list_remove(i->messages, node);
+    Cache_Block *b = checkpoint_read_block(ck);
+    int cycles;
+    Message_Direction dir;
+    checkpoint_read_value(ck, cycles);
+    checkpoint_read_value(ck, dir);
+    assert(cycles >= 0 && dir <= MSG_MEM_TO_L2);
+    event_schedule(i->events, cycles, EVENT_INTERCONNECT,
+                   interconnect_deliver_fns[dir], i, b);
+    i->num_messages++;
   }
-  list_iterator_destroy(it);
-  list_destroy(i->messages);
 }
 
 // enqueue the message to the message queue
 static void interconnect_send(Interconnect_State *i, Cache_Block *b, int cycles,
                               Message_Direction dir)
 {
-  Message *msg = (Message *)malloc(sizeof(Message));
-  msg->b = b;
-  /* subtract current cycle */
-  msg->cycles = cycles - 1;
-  msg->dir = dir;
-  list_rpush(i->messages, list_node_new(msg));
+  /* delivered in the cycle that comes cycles from now */
+  event_schedule(i->events, cycles, EVENT_INTERCONNECT,
+                 interconnect_deliver_fns[dir], i, b);
+  i->num_messages++;
+  trace_event(i->trace, TRACE_INT, TRACE_INT_SEND, b->tag, dir << 16 | cycles);
+
+  switch (dir)
+  {
+  case MSG_L2_TO_L1:
+    stat_inc(i->stat_l2_to_l1);
+    break;
+  case MSG_L2_TO_MEM:
+    stat_inc(i->stat_l2_to_mem);
+    break;
+  case MSG_MEM_TO_L2:
+    stat_inc(i->stat_mem_to_l2);
+    break;
+  }
 }
 
+// Interconnection processes 3 types of messages:
+// 1. L2 to L1
+// 2. L2 to MEM
+// 3. MEM to L2
+// Each one is delivered by its own event, in the cycle it is due
 void interconnect_cycle(Interconnect_State *i)
 {
-  // Notice this queue is used all over the place to ensure the timing is
-  // processed correctly. This is a common pattern in hardware simulation.
-
-  // Interconnection processes 3 types of messages:
-  // 1. L2 to L1
-  // 2. L2 to MEM
-  // 3. MEM to L2
-  // instantiates the message queue
-  list_node_t *node;
-  list_iterator_t *it = list_iterator_new(i->messages, LIST_HEAD);
-  // Traverse the message queue, if there is a message, decrement the cycle of
-  // message each message is an event, for example. inserting the block or add a
-  // memory request
-  while ((node = list_iterator_next(it)))
-  {
-    Message *msg = (Message *)node->val;
-    if (msg->cycles > 0)
-    {
-      msg->cycles--;
-    }
-    else
-    {
-      // determine what kind of message this is
-      switch (msg->dir)
-      {
-      case MSG_L2_TO_L1:
-        l1_insert_block(msg->b);
-        break;
-      case MSG_L2_TO_MEM:
-        memory_add_request(i->m, msg->b);
-        break;
-      case MSG_MEM_TO_L2:
-        l2_insert_block(i->l2, msg->b);
-        break;
-      }
-      free(msg);
-      list_remove(i->messages, node);
-    }
-  }
-  list_iterator_destroy(it);
+  stat_sample(i->stat_in_flight, i->num_messages, 1);
+}
+
+void interconnect_skip_cycles(Interconnect_State *i, int n)
+{
+  stat_sample(i->stat_in_flight, i->num_messages, n);
 }
 
 // Notice that is groups the interconnect functions by the direction of the
@@ -111,6 +174,16 @@ void interconnect_l1_to_l2(Interconnect_State *i, Cache_Block *b)
   l2_cache_probe(i->l2, b);
 }
 
+bool interconnect_l1_to_l2_idle(Interconnect_State *i, Cache_Block *b)
+{
+  return l2_cache_probe_idle(i->l2, b);
+}
+
+void interconnect_l1_to_l2_warm(Interconnect_State *i, uint32_t tag)
+{
+  l2_cache_warm(i->l2, tag);
+}
+
 void interconnect_l1_to_l2_cancel(Interconnect_State *i, Cache_Block *b)
 {
   /* no latency for cancellation */
@@ -121,8 +194,6 @@ void interconnect_l2_to_l1(Interconnect_State *i, Cache_Block *b)
 {
   int cycles = 15;
   interconnect_send(i, b, cycles, MSG_L2_TO_L1);
-  debug_int("L2 to L1 notification for 0x%x inserted (%d cylces left)\n",
-            b->tag, cycles);
 }
 
 void interconnect_l2_to_l1_no_latency(Interconnect_State *i
@@ -136,14 +207,10 @@ void interconnect_l2_to_mem(Interconnect_State *i, Cache_Block *b)
 {
   int cycles = 5;
   interconnect_send(i, b, cycles, MSG_L2_TO_MEM);
-  debug_int("L2 to MEM notification for 0x%x inserted (%d cylces left)\n",
-            b->tag, cycles);
 }
 
 void interconnect_mem_to_l2(Interconnect_State *i, Cache_Block *b)
 {
   int cycles = 5;
   interconnect_send(i, b, cycles, MSG_MEM_TO_L2);
-  debug_int("MEM to L2 notification for 0x%x inserted (%d cylces left)\n",
-            b->tag, cycles);
 }
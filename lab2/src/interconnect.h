@@ -5,27 +5,49 @@
 
 typedef struct Interconnect_State { // connects to l2 cache state and memory state
 // The interconnect state is used to store the latency queue, which is used to store the latency of the memory hierarchy
-  /* latency queue */
-  list_t *messages;
+  /* latency queue: every message is an event delivering its block */
+  Event_Queue *events;
+  /* messages in flight */
+  int num_messages;
   /* ptr to L2 cache */
   L2_Cache_State *l2;
   /* ptr to memory */
   Memory_State *m;
+  /* stats */
+  Stat *stat_l2_to_l1, *stat_l2_to_mem, *stat_mem_to_l2, *stat_in_flight;
+  Trace *trace;
 } Interconnect_State;
 
 /* init interconnect */
 void interconnect_init(Interconnect_State *i, L2_Cache_State *l2,
-                       Memory_State *m);
+                       Memory_State *m, Event_Queue *events, Stats *stats,
+                       Trace *trace);
 
-/* free memory allocate by interconnect */
-void interconnect_free(Interconnect_State *i);
+/* write/read the latency queue to/from a checkpoint */
+void interconnect_save(Interconnect_State *i, Checkpoint *ck);
+void interconnect_restore(Interconnect_State *i, Checkpoint *ck);
 
-/* simulate a cycle i.e. process latency queue */
+/* simulate a cycle; the messages due were delivered by their events, this
+ * only samples the stats */
 void interconnect_cycle(Interconnect_State *i);
 
+/* number of messages in flight */
+static inline int interconnect_in_flight(Interconnect_State *i) {
+  return i->num_messages;
+}
+
+/* same as n calls to interconnect_cycle */
+void interconnect_skip_cycles(Interconnect_State *i, int n);
+
 /* send cache probe from L1 to L2 */
 void interconnect_l1_to_l2(Interconnect_State *i, Cache_Block *b);
 
+/* true if a probe from L1 to L2 would not change any state */
+bool interconnect_l1_to_l2_idle(Interconnect_State *i, Cache_Block *b);
+
+/* functional L1 miss while fast-forwarding, warms up L2 without latency */
+void interconnect_l1_to_l2_warm(Interconnect_State *i, uint32_t tag);
+
 /* send cancellation from L1 to L2 */
 void interconnect_l1_to_l2_cancel(Interconnect_State *i, Cache_Block *b);
 
@@ -0,0 +1,100 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "konata.h"
+
+/* longest command written at once */
+#define KONATA_MAX_COMMAND 128
+
+static void konata_drain(Konata *k) {
+  fwrite(k->buffer, 1, k->length, k->file);
+  k->length = 0;
+}
+
+static void konata_printf(Konata *k, const char *fmt, ...) {
+  va_list args;
+
+  if (k->length + KONATA_MAX_COMMAND > KONATA_BUFFER_SIZE)
+    konata_drain(k);
+
+  va_start(args, fmt);
+  int n = vsnprintf(k->buffer + k->length, KONATA_MAX_COMMAND, fmt, args);
+  va_end(args);
+  k->length += n < KONATA_MAX_COMMAND ? n : KONATA_MAX_COMMAND - 1;
+}
+
+bool konata_open(Konata *k, const char *filename, uint64_t cycle) {
+  memset(k, 0, sizeof(Konata));
+  k->file = fopen(filename, "w");
+  if (k->file == NULL)
+    return false;
+
+  k->buffer = (char *)malloc(KONATA_BUFFER_SIZE);
+  k->cycle = cycle;
+  k->next_id = 1;
+  konata_printf(k, "Kanata\t0004\nC=\t%llu\n", (unsigned long long)cycle);
+  return true;
+}
+
+void konata_cycle(Konata *k, uint64_t cycle) {
+  if (cycle == k->cycle)
+    return;
+
+  /* the instructions that left are written one cycle later even when the
+   * cycles after that were skipped */
+  uint64_t step = k->num_leaving ? 1 : cycle - k->cycle;
+  konata_printf(k, "C\t%llu\n", (unsigned long long)step);
+  k->cycle += step;
+
+  for (int i = 0; i < k->num_leaving; ++i) {
+    Konata_Leaving *l = k->leaving + i;
+    konata_printf(k, "E\t%llu\t0\t%s\n", (unsigned long long)l->id, l->stage);
+    konata_printf(k, "R\t%llu\t%llu\t%d\n", (unsigned long long)l->id,
+                  (unsigned long long)(l->squashed ? 0 : k->next_retire_id++),
+                  l->squashed);
+  }
+  k->num_leaving = 0;
+
+  if (k->cycle != cycle)
+    konata_cycle(k, cycle);
+}
+
+uint64_t konata_fetch(Konata *k, uint32_t pc, uint32_t instruction) {
+  uint64_t id = k->next_id++;
+
+  konata_printf(k, "I\t%llu\t%llu\t0\n", (unsigned long long)id,
+                (unsigned long long)id);
+  konata_printf(k, "L\t%llu\t0\t%08x: %08x\n", (unsigned long long)id, pc,
+                instruction);
+  konata_printf(k, "S\t%llu\t0\tF\n", (unsigned long long)id);
+  return id;
+}
+
+void konata_stage(Konata *k, uint64_t id, const char *from, const char *to) {
+  konata_printf(k, "E\t%llu\t0\t%s\n", (unsigned long long)id, from);
+  konata_printf(k, "S\t%llu\t0\t%s\n", (unsigned long long)id, to);
+}
+
+void konata_leave(Konata *k, uint64_t id, const char *stage, bool squashed) {
+  assert(k->num_leaving < KONATA_MAX_LEAVING);
+  Konata_Leaving *l = k->leaving + k->num_leaving++;
+  l->id = id;
+  l->stage = stage;
+  l->squashed = squashed;
+}
+
+bool konata_close(Konata *k) {
+  if (k->file == NULL)
+    return true;
+
+  /* the last instructions left during the last cycle */
+  konata_cycle(k, k->cycle + 1);
+  konata_drain(k);
+  bool ok = !ferror(k->file);
+  ok = fclose(k->file) == 0 && ok;
+  free(k->buffer);
+  memset(k, 0, sizeof(Konata));
+  return ok;
+}
@@ -0,0 +1,67 @@
+/*
+ * Per-instruction pipeline trace
+ *
+ * Writes the life of every dynamic instruction in the Kanata log format that
+ * the Konata pipeline viewer loads (github.com/shioyadan/Konata): when it
+ * started fetch, each stage it entered after that, and whether it retired or
+ * was squashed. An instruction enters fetch at the first cycle fetch tries
+ * its PC, so I$ misses show up as long F stages.
+ *
+ * The log is a stream of commands in cycle order. It is built in a large
+ * memory buffer and written out in blocks.
+ */
+
+#ifndef _KONATA_H_
+#define _KONATA_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
+
+#define KONATA_BUFFER_SIZE (1 << 20)
+/* instructions that can leave the pipeline in one cycle */
+#define KONATA_MAX_LEAVING 16
+
+/* an instruction that left in the last cycle; it is written in the next one
+ * so that its last stage lasts the cycle it spent there */
+typedef struct Konata_Leaving {
+  uint64_t id;
+  const char *stage;
+  bool squashed;
+} Konata_Leaving;
+
+struct Konata {
+  FILE *file;
+  char *buffer;
+  size_t length;
+  /* cycle of the commands being written */
+  uint64_t cycle;
+  /* ids of the next instruction and of the next retirement */
+  uint64_t next_id, next_retire_id;
+  Konata_Leaving leaving[KONATA_MAX_LEAVING];
+  int num_leaving;
+};
+
+/* start a log at cycle, false if filename can't be created */
+bool konata_open(Konata *k, const char *filename, uint64_t cycle);
+
+static inline bool konata_enabled(Konata *k) { return k->file != NULL; }
+
+/* move on to cycle; the instructions that left before it are written */
+void konata_cycle(Konata *k, uint64_t cycle);
+
+/* a new instruction starts fetch at pc, returns its id (never 0) */
+uint64_t konata_fetch(Konata *k, uint32_t pc, uint32_t instruction);
+
+/* instruction id moves from stage from to stage to */
+void konata_stage(Konata *k, uint64_t id, const char *from, const char *to);
+
+/* instruction id leaves the pipeline from stage, retired or squashed */
+void konata_leave(Konata *k, uint64_t id, const char *stage, bool squashed);
+
+/* write the rest of the log and close it, false on a write error */
+bool konata_close(Konata *k);
+
+#endif
@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "debug.h"
+#include "checkpoint.h"
 #include "l1_cache.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
 
 static int bit_length(uint32_t n) {
   uint32_t l = 0;
@@ -18,8 +21,11 @@ static int bit_length(uint32_t n) {
 // total_size is the total size of the cache
 // num_ways is the number of ways
 // i is the interconnection state
-void l1_cache_init(L1_Cache_State *c, char *label, int total_size, int num_ways,
-                   Interconnect_State *i) {
+// name is the group of its stats, e.g. "l1d"
+// is_inst tells whether its misses are I$ or D$ misses in the profile
+void l1_cache_init(L1_Cache_State *c, char *label, char *name, int total_size,
+                   int num_ways, bool is_inst, Interconnect_State *i,
+                   Stats *stats, Profile *profile, Trace *trace) {
 
   c->label = label;
   c->total_size = total_size;
@@ -40,9 +46,17 @@ void l1_cache_init(L1_Cache_State *c, char *label, int total_size, int num_ways,
 
   // timestamp is used to determine the recency of the cache block
   c->timestamp = 0;
+  c->num_pending = 0;
   // set the pointer of interconnection it used to the interconnection for
   // accessing the memory hierarchy
   c->interconnect = i;
+
+  c->stat_hits = stats_counter(stats, name, "hits");
+  c->stat_misses = stats_counter(stats, name, "misses");
+  c->miss_pending = false;
+  c->profile = profile;
+  c->is_inst = is_inst;
+  c->trace = trace;
 }
 
 void l1_cache_free(L1_Cache_State *c) { free(c->blocks); }
@@ -65,6 +79,26 @@ static uint32_t get_set_idx(L1_Cache_State *c, uint32_t addr) {
   return set_idx;
 }
 
+static inline void l1_trace(L1_Cache_State *c, Trace_Event event, uint32_t tag,
+                            uint32_t extra) {
+  trace_event(c->trace, c->is_inst ? TRACE_L1I : TRACE_L1D, event, tag, extra);
+}
+
+// Index of tag in the pending-miss table, -1 if no block is on its way
+static int find_pending(L1_Cache_State *c, uint32_t tag) {
+  for (int i = 0; i < c->num_pending; ++i) {
+    if (c->pending_tags[i] == tag)
+      return i;
+  }
+  return -1;
+}
+
+static void remove_pending(L1_Cache_State *c, uint32_t tag) {
+  int i = find_pending(c, tag);
+  if (i >= 0)
+    c->pending_tags[i] = c->pending_tags[--c->num_pending];
+}
+
 static void write_block(L1_Cache_Block *block, uint32_t tag, int timestamp) {
   // This updates the block with the tag and timestamp to ensure the recency of
   // the block
@@ -78,7 +112,7 @@ static void write_block(L1_Cache_Block *block, uint32_t tag, int timestamp) {
 // Only returns miss or hit, the actual data is not stored in the cache block
 // This is a simulation of the cache access, the actual data is being handled by
 // other functions
-Cache_Result l1_cache_access(L1_Cache_State *c, uint32_t addr) {
+Cache_Result l1_cache_access(L1_Cache_State *c, uint32_t addr, uint32_t pc) {
   /* increase timestamp for recency updates everytime l1 $ gets accessed*/
   c->timestamp++;
 
@@ -96,42 +130,85 @@ Cache_Result l1_cache_access(L1_Cache_State *c, uint32_t addr) {
   for (int way = 0; way < c->num_ways; ++way) {
     block = set + way;
     if (block->valid && (block->tag == tag)) {
-      // the use of debug is to print the information of the cache access, this
-      // is used for debugging This helps printing out vital information about
-      // cache hit for tracing.
-      debug_l1("%s: [0x%X] HIT in set %d way %d\n", c->label, tag, set_idx,
-               way);
+      // trace the cache hit, set and way included
+      l1_trace(c, TRACE_L1_HIT, tag, set_idx << 8 | way);
       // the block is updated with the tag and timestamp to ensure the recency
       // of the block
       write_block(block, tag, c->timestamp);
+      stat_inc(c->stat_hits);
       return CACHE_HIT;
     }
   }
 
-  // important event to print out the cache miss
-  debug_l1("%s: [0x%X] MISS in set %d\n", c->label, tag, set_idx);
+  // important event to trace the cache miss
+  l1_trace(c, TRACE_L1_MISS, tag, set_idx);
+
+  if (!c->miss_pending || c->miss_tag != tag) {
+    stat_inc(c->stat_misses);
+    c->miss_tag = tag;
+    c->miss_pending = true;
+
+    Profile_Entry *e = profile_entry(c->profile, pc);
+    if (e) {
+      if (c->is_inst)
+        e->icache_misses++;
+      else
+        e->dcache_misses++;
+    }
+  }
+
+  /* the block is already on its way, L2 has nothing new to say */
+  if (find_pending(c, tag) >= 0)
+    return CACHE_MISS;
 
   /* addr not in cache -> probe L2 cache */
   Cache_Block *b = (Cache_Block *)malloc(sizeof(Cache_Block));
   b->tag = tag;
   b->l1 = c;
+  b->pc = pc;
 
-  // Probing l2 cache through interconnections
+  // Probing l2 cache through interconnections, a block for the line always
+  // comes back so the access just waits for it (a full table keeps probing)
   interconnect_l1_to_l2(c->interconnect, b);
+  if (c->num_pending < L1_PENDING_SIZE)
+    c->pending_tags[c->num_pending++] = tag;
 
   return CACHE_MISS;
 }
 
-// Inserts a cache block into l1$, the $block pointer is being passed in
-// later being transformed into a L1_Cache_Block, b is then being freed
-void l1_insert_block(struct Cache_Block *b) {
-  // b is a pointer to the $ block from either d$ or i$
-  L1_Cache_State *c = b->l1;
+// Tag lookup alone, the recency and the stats are left as they are
+bool l1_cache_contains(L1_Cache_State *c, uint32_t addr) {
+  uint32_t tag = CACHE_BLOCK_ALIGNED_ADDR(addr);
+  L1_Cache_Block *set = c->blocks + get_set_idx(c, addr) * c->num_ways;
 
-  // $ is accessed
-  c->timestamp++;
+  for (int way = 0; way < c->num_ways; ++way) {
+    if (set[way].valid && set[way].tag == tag)
+      return true;
+  }
+  return false;
+}
+
+// Side-effect free version of l1_cache_access for a stalled stage: it answers
+// whether retrying the access this cycle would be a miss that L2 ignores
+bool l1_cache_access_idle(L1_Cache_State *c, uint32_t addr) {
+  uint32_t tag = CACHE_BLOCK_ALIGNED_ADDR(addr);
+
+  if (l1_cache_contains(c, addr))
+    return false;
+
+  if (find_pending(c, tag) >= 0)
+    return true;
+
+  Cache_Block b;
+  b.tag = tag;
+  b.l1 = c;
 
-  uint32_t tag = b->tag;
+  return interconnect_l1_to_l2_idle(c->interconnect, &b);
+}
+
+// Places tag into its set (invalid way first, else the LRU way) unless it is
+// already cached
+static void insert_tag(L1_Cache_State *c, uint32_t tag) {
   uint32_t set_idx = get_set_idx(c, tag);
   L1_Cache_Block *set = c->blocks + set_idx * c->num_ways;
   L1_Cache_Block *block; // A pointer to the $ block
@@ -141,7 +218,7 @@ void l1_insert_block(struct Cache_Block *b) {
     block = set + way;
     if (block->valid && (block->tag == tag)) {
       /* if block is already in cache don't insert it again */
-      goto out;
+      return;
     }
   }
 
@@ -149,10 +226,9 @@ void l1_insert_block(struct Cache_Block *b) {
   for (int way = 0; way < c->num_ways; ++way) {
     block = set + way;
     if (!block->valid) {
-      debug_l1("%s: [0x%X] inserted (invalid) into set %d way %d\n", c->label,
-               tag, set_idx, way);
+      l1_trace(c, TRACE_L1_INSERT, tag, set_idx << 8 | way);
       write_block(block, tag, c->timestamp);
-      goto out;
+      return;
     }
   }
 
@@ -169,18 +245,86 @@ void l1_insert_block(struct Cache_Block *b) {
     }
   }
 
-  debug_l1("%s: [0x%X] inserted (lru) in set %d way %d\n", c->label, tag,
-           set_idx, (int)(block - set));
+  l1_trace(c, TRACE_L1_INSERT, tag, set_idx << 8 | (int)(block - set));
 
   // the block is updated with the tag and timestamp to ensure the recency of
   // the block tag and recency must be kept
   write_block(block, tag, c->timestamp);
+}
+
+// Inserts a cache block into l1$, the $block pointer is being passed in
+// later being transformed into a L1_Cache_Block, b is then being freed
+void l1_insert_block(struct Cache_Block *b) {
+  // b is a pointer to the $ block from either d$ or i$
+  L1_Cache_State *c = b->l1;
+
+  // $ is accessed
+  c->timestamp++;
+
+  insert_tag(c, b->tag);
+  remove_pending(c, b->tag);
+  if (c->miss_tag == b->tag)
+    c->miss_pending = false;
 
-out:
   /* always free cache block */
   free(b);
 }
 
+// Functional access used while fast-forwarding: hits update the recency,
+// misses fill the block right away and warm up L2 as well
+void l1_cache_warm(L1_Cache_State *c, uint32_t addr) {
+  c->timestamp++;
+
+  uint32_t tag = CACHE_BLOCK_ALIGNED_ADDR(addr);
+  L1_Cache_Block *set = c->blocks + get_set_idx(c, addr) * c->num_ways;
+
+  for (int way = 0; way < c->num_ways; ++way) {
+    if (set[way].valid && set[way].tag == tag) {
+      write_block(set + way, tag, c->timestamp);
+      return;
+    }
+  }
+
+  insert_tag(c, tag);
+  interconnect_l1_to_l2_warm(c->interconnect, tag);
+}
+
+void l1_cache_save(L1_Cache_State *c, Checkpoint *ck) {
+  checkpoint_write_value(ck, c->num_sets);
+  checkpoint_write_value(ck, c->num_ways);
+  checkpoint_write_value(ck, c->timestamp);
+  checkpoint_write(ck, c->blocks,
+                   c->num_sets * c->num_ways * sizeof(L1_Cache_Block));
+  checkpoint_write_value(ck, c->num_pending);
+  checkpoint_write(ck, c->pending_tags, c->num_pending * sizeof(uint32_t));
+  checkpoint_write_value(ck, c->miss_tag);
+  checkpoint_write_value(ck, c->miss_pending);
+}
+
+// The geometry is fixed at init, a checkpoint of another one can't be used
+void l1_cache_restore(L1_Cache_State *c, Checkpoint *ck) {
+  int num_sets, num_ways;
+
+  checkpoint_read_value(ck, num_sets);
+  checkpoint_read_value(ck, num_ways);
+  if (num_sets != c->num_sets || num_ways != c->num_ways) {
+    printf("Error: checkpoint has a different %s geometry\n", c->label);
+    exit(-1);
+  }
+  checkpoint_read_value(ck, c->timestamp);
+  checkpoint_read(ck, c->blocks,
+                  c->num_sets * c->num_ways * sizeof(L1_Cache_Block));
+  checkpoint_read_value(ck, c->num_pending);
+  if (c->num_pending < 0 || c->num_pending > L1_PENDING_SIZE) {
+    printf("Error: checkpoint has too many %s pending misses\n", c->label);
+    exit(-1);
+  }
+  checkpoint_read(ck, c->pending_tags, c->num_pending * sizeof(uint32_t));
+  /* the miss being retried was counted before the checkpoint */
+  checkpoint_read_value(ck, c->miss_tag);
+  checkpoint_read_value(ck, c->miss_pending);
+}
+
 // This is used when the $ access @ fetch state gets flushed, this is used to
 // cancel the access
 void l1_cancel_cache_access(L1_Cache_State *c, uint32_t addr) {
@@ -188,6 +332,10 @@ void l1_cancel_cache_access(L1_Cache_State *c, uint32_t addr) {
   Cache_Block b;
   b.tag = CACHE_BLOCK_ALIGNED_ADDR(addr);
   b.l1 = c;
+  if (c->miss_tag == b.tag)
+    c->miss_pending = false;
+  remove_pending(c, b.tag);
+  l1_trace(c, TRACE_L1_CANCEL, b.tag, 0);
 
   // this cancel statement must also be called in the interconnection
   interconnect_l1_to_l2_cancel(c->interconnect, &b);
@@ -6,6 +6,9 @@
 
 typedef enum Cache_Result { CACHE_MISS, CACHE_HIT } Cache_Result;
 
+/* lines an L1 can wait on at once without probing L2 again */
+#define L1_PENDING_SIZE 8
+
 // Notice that as long as we have addr and tag, we can access the cache block through memory read
 // thus no need to store the data at hand
 typedef struct L1_Cache_Block {
@@ -35,26 +38,54 @@ struct L1_Cache_State {
   int timestamp;
   /* ptr to cache blocks */
   L1_Cache_Block *blocks;
+  /* pending-miss table: lines whose block is on its way from L2, a repeated
+   * access to one of them misses right away */
+  uint32_t pending_tags[L1_PENDING_SIZE];
+  int num_pending;
   /* ptr to interconnect */
   // all the memory hierarchy is connected through the interconnect
   // thus every states has an associated pointer to the interconnection
   Interconnect_State *interconnect;
+
+  /* stats; a miss retried while its block is on the way counts once */
+  Stat *stat_hits, *stat_misses;
+  uint32_t miss_tag;
+  bool miss_pending;
+  /* misses are also charged to the PC that caused them */
+  Profile *profile;
+  bool is_inst;
+  Trace *trace;
 };
 
-/* init L1 cache */
-void l1_cache_init(L1_Cache_State *c, char *label, int total_size, int num_ways,
-                   Interconnect_State *i);
+/* init L1 cache, its stats are registered under the group name; is_inst
+ * selects which miss count of the profile it charges */
+void l1_cache_init(L1_Cache_State *c, char *label, char *name, int total_size,
+                   int num_ways, bool is_inst, Interconnect_State *i,
+                   Stats *stats, Profile *profile, Trace *trace);
 
 /* free memory used by cache, the destructor */
 void l1_cache_free(L1_Cache_State *c);
 
-/* simulates a cache access */
+/* simulates a cache access by the instruction at pc */
 // l1 $ states needs to get updated
-Cache_Result l1_cache_access(L1_Cache_State *c, uint32_t addr);
+Cache_Result l1_cache_access(L1_Cache_State *c, uint32_t addr, uint32_t pc);
+
+/* true if addr is cached; nothing is updated, not even the LRU order */
+bool l1_cache_contains(L1_Cache_State *c, uint32_t addr);
+
+/* true if an access to addr would miss without changing any state below L1 */
+bool l1_cache_access_idle(L1_Cache_State *c, uint32_t addr);
 
 /* insert block into cache */
 void l1_insert_block(Cache_Block *b);
 
+/* access without timing (fast-forward): fill L1 and L2 tags directly */
+void l1_cache_warm(L1_Cache_State *c, uint32_t addr);
+
+/* write/read the cache contents and pending misses to/from a checkpoint */
+void l1_cache_save(L1_Cache_State *c, Checkpoint *ck);
+void l1_cache_restore(L1_Cache_State *c, Checkpoint *ck);
+
 /* cancel request to memory hierarchy e.g. on branch recovery */
 void l1_cancel_cache_access(L1_Cache_State *c, uint32_t addr);
 
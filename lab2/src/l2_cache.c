@@ -3,9 +3,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "l2_cache.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
 
-void l2_cache_init(L2_Cache_State *l2, Interconnect_State *interconnect) {
+#define MSHR_FREE_BITS 64
+
+static void mshr_file_reset(L2_Cache_State *c);
+
+void l2_cache_init(L2_Cache_State *l2, int num_mshrs, int mshr_targets,
+                   Interconnect_State *interconnect, Stats *stats,
+                   Profile *profile, Trace *trace) {
   l2->total_size = 256 * 1024;
   l2->num_ways = 16;
   l2->num_sets = 512;
@@ -22,13 +32,57 @@ void l2_cache_init(L2_Cache_State *l2, Interconnect_State *interconnect) {
 
   // Register the interconnection l2 cache connects to
   l2->interconnect = interconnect;
-  for (int i = 0; i < L2_MSHR_SIZE; ++i) {
+  l2->num_mshrs = num_mshrs;
+  l2->mshrs = (L2_MSHR *)calloc(num_mshrs, sizeof(L2_MSHR));
+  l2->mshr_targets = mshr_targets;
+  l2->targets =
+      (L2_MSHR_Target *)calloc(num_mshrs * mshr_targets, sizeof(L2_MSHR_Target));
+  for (int i = 0; i < l2->num_mshrs; ++i) {
     L2_MSHR *mshr = l2->mshrs + i;
+    mshr->targets = l2->targets + i * mshr_targets;
     mshr->done = true;
   }
+  l2->mshr_count = 0;
+
+  /* the index is at least twice the number of MSHRs */
+  l2->mshr_index_bits = 1;
+  while ((1 << l2->mshr_index_bits) < 2 * num_mshrs)
+    l2->mshr_index_bits++;
+  l2->mshr_index = (int *)malloc((1 << l2->mshr_index_bits) * sizeof(int));
+  l2->mshr_free = (uint64_t *)malloc(
+      (num_mshrs + MSHR_FREE_BITS - 1) / MSHR_FREE_BITS * sizeof(uint64_t));
+  mshr_file_reset(l2);
+  l2->blocked_requests = list_new();
+
+  // an L1 miss probes once, a probe that only finds its MSHR pending does
+  // not count; blocked counts the probes that found no free MSHR and
+  // blocked_cycles the cycles in which one of them waits for it
+  l2->stat_hits = stats_counter(stats, "l2", "hits");
+  l2->stat_misses = stats_counter(stats, "l2", "misses");
+  l2->stat_mshr_occupancy =
+      stats_histogram(stats, "l2", "mshr_occupancy", num_mshrs + 1, 1);
+  l2->stat_blocked = stats_counter(stats, "l2", "blocked");
+  l2->stat_blocked_cycles = stats_counter(stats, "l2", "blocked_cycles");
+  // misses of one L1 on a line the other one already waits for
+  l2->stat_merged = stats_counter(stats, "l2", "merged");
+  l2->profile = profile;
+  l2->trace = trace;
 }
 
-void l2_cache_free(L2_Cache_State *c) { free(c->blocks); }
+void l2_cache_free(L2_Cache_State *c) {
+  list_node_t *node;
+
+  free(c->blocks);
+  free(c->mshrs);
+  free(c->targets);
+  free(c->mshr_index);
+  free(c->mshr_free);
+  while ((node = list_lpop(c->blocked_requests))) {
+    free(node->val);
+    LIST_FREE(node);
+  }
+  list_destroy(c->blocked_requests);
+}
 
 static uint32_t get_set_idx(L2_Cache_State *c, uint32_t addr) {
   uint32_t mask = ~0;
@@ -52,14 +106,164 @@ static bool cache_block_equal(Cache_Block *a, Cache_Block *b) {
   return a != NULL && b != NULL && a->tag == b->tag && a->l1 == b->l1;
 }
 
+/* MSHR file */
+
+static uint32_t mshr_hash(L2_Cache_State *c, uint32_t tag) {
+  /* Fibonacci hashing of the line number */
+  return ((tag / CACHE_BLOCK_SIZE) * 2654435769u) >> (32 - c->mshr_index_bits);
+}
+
+// Slot of the index that holds the MSHR of the line tag, or the empty slot
+// where it would go
+static uint32_t mshr_slot(L2_Cache_State *c, uint32_t tag) {
+  uint32_t mask = (1u << c->mshr_index_bits) - 1;
+  uint32_t slot = mshr_hash(c, tag);
+
+  while (c->mshr_index[slot] >= 0 && c->mshrs[c->mshr_index[slot]].tag != tag)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+// Empties slot and moves the entries after it back, so that no lookup that
+// passes over it stops early (no tombstones needed)
+static void mshr_index_remove(L2_Cache_State *c, uint32_t slot) {
+  uint32_t mask = (1u << c->mshr_index_bits) - 1;
+  uint32_t next = slot;
+
+  for (;;) {
+    c->mshr_index[slot] = -1;
+    for (;;) {
+      next = (next + 1) & mask;
+      if (c->mshr_index[next] < 0)
+        return;
+      /* an entry can move back unless its home lies between slot and it */
+      uint32_t home = mshr_hash(c, c->mshrs[c->mshr_index[next]].tag);
+      if (((next - home) & mask) >= ((next - slot) & mask))
+        break;
+    }
+    c->mshr_index[slot] = c->mshr_index[next];
+    slot = next;
+  }
+}
+
+// Lowest free MSHR, -1 if all are allocated
+static int mshr_first_free(L2_Cache_State *c) {
+  int words = (c->num_mshrs + MSHR_FREE_BITS - 1) / MSHR_FREE_BITS;
+
+  for (int w = 0; w < words; ++w) {
+    if (c->mshr_free[w])
+      return w * MSHR_FREE_BITS + __builtin_ctzll(c->mshr_free[w]);
+  }
+  return -1;
+}
+
+static void mshr_set_free(L2_Cache_State *c, int i, bool is_free) {
+  uint64_t bit = 1ull << (i % MSHR_FREE_BITS);
+
+  if (is_free)
+    c->mshr_free[i / MSHR_FREE_BITS] |= bit;
+  else
+    c->mshr_free[i / MSHR_FREE_BITS] &= ~bit;
+}
+
+// Rebuilds the index and the free bitmap from the MSHRs
+static void mshr_file_reset(L2_Cache_State *c) {
+  memset(c->mshr_index, 0xff, (1 << c->mshr_index_bits) * sizeof(int));
+  memset(c->mshr_free, 0,
+         (c->num_mshrs + MSHR_FREE_BITS - 1) / MSHR_FREE_BITS *
+             sizeof(uint64_t));
+
+  for (int i = 0; i < c->num_mshrs; ++i) {
+    L2_MSHR *mshr = c->mshrs + i;
+    mshr_set_free(c, i, mshr->done);
+    if (!mshr->done)
+      c->mshr_index[mshr_slot(c, mshr->tag)] = i;
+  }
+}
+
+// The MSHR allocated for the line tag, NULL if there is none
+static L2_MSHR *find_mshr(L2_Cache_State *l2, uint32_t tag) {
+  int i = l2->mshr_index[mshr_slot(l2, tag)];
+  return i < 0 ? NULL : l2->mshrs + i;
+}
+
+// The live request of L1 l1 waiting on mshr, NULL if it has none; any other
+// request of that L1 on the line was cancelled
+static L2_MSHR_Target *find_target(L2_MSHR *mshr, L1_Cache_State *l1) {
+  for (int i = 0; i < mshr->num_targets; ++i) {
+    L2_MSHR_Target *target = mshr->targets + i;
+    if (target->valid && target->cache_block->l1 == l1)
+      return target;
+  }
+  return NULL;
+}
+
+// Targets of mshr beyond the first one of each L1, i.e. requests of L1s that
+// cancelled and asked again
+static int spare_targets(L2_MSHR *mshr) {
+  int spares = 0;
+
+  for (int i = 1; i < mshr->num_targets; ++i) {
+    for (int j = 0; j < i; ++j) {
+      if (mshr->targets[j].cache_block->l1 == mshr->targets[i].cache_block->l1) {
+        spares++;
+        break;
+      }
+    }
+  }
+  return spares;
+}
+
+// Whether the probe b of an L1 without a live request on mshr gets a target:
+// every L1 has one, and an L1 that cancelled its request can only come back
+// through the targets beyond one per L1
+static bool target_free(L2_Cache_State *l2, L2_MSHR *mshr, Cache_Block *b) {
+  for (int i = 0; i < mshr->num_targets; ++i) {
+    if (mshr->targets[i].cache_block->l1 == b->l1)
+      return spare_targets(mshr) < l2->mshr_targets - L2_NUM_L1S;
+  }
+  return mshr->num_targets < l2->mshr_targets;
+}
+
+static list_node_t *find_blocked(L2_Cache_State *l2, Cache_Block *b) {
+  list_node_t *node;
+  list_iterator_t *it = list_iterator_new(l2->blocked_requests, LIST_HEAD);
+
+  while ((node = list_iterator_next(it)) && !cache_block_equal(node->val, b))
+    ;
+  list_iterator_destroy(it);
+  return node;
+}
+
+// Parks b until an MSHR frees; an L1 whose pending-miss table is full probes
+// again every cycle, those repeats are dropped
+static void block_request(L2_Cache_State *l2, Cache_Block *b) {
+  if (find_blocked(l2, b)) {
+    free(b);
+    return;
+  }
+  list_rpush(l2->blocked_requests, list_node_new(b));
+}
+
+static bool mshrs_exhausted(L2_Cache_State *l2) {
+  return l2->mshr_count >= l2->num_mshrs && l2->blocked_requests->len > 0;
+}
+
+// L2 takes b over: it goes back to L1 on a hit, waits in an MSHR on a miss
+// (a new one, or the one already allocated for the line, which also takes a
+// request of an L1 that cancelled its earlier one), and is freed when its L1
+// already waits on the line. A probe that can't be served yet
+// waits in the blocked queue, so L1 never has to retry.
 void l2_cache_probe(L2_Cache_State *l2, struct Cache_Block *b) {
   /* L1 cannot probe L2 if no MSHR is free */
 
   // Notice that not all statement must be written into a functions,
   // only necessary functions are written into the functions, or the function
   // that tries to access beyond the scope of this function
-  if (l2->mshr_count >= L2_MSHR_SIZE) {
-    debug_l2("[0x%X] all MSHRs in use\n", b->tag);
+  if (l2->mshr_count >= l2->num_mshrs) {
+    trace_event(l2->trace, TRACE_L2, TRACE_L2_MSHR_FULL, b->tag, 0);
+    stat_inc(l2->stat_blocked);
+    block_request(l2, b);
     return;
   }
 
@@ -68,7 +272,6 @@ void l2_cache_probe(L2_Cache_State *l2, struct Cache_Block *b) {
 // DRAM access
 #if DEBUG_L2_ALWAYS_HIT
   /* useful for e.g. test L2 hit latency */
-  debug_l2("ALWAYS HIT IS ENABLED!\n");
   interconnect_l2_to_l1(l2->interconnect, b);
   return;
 #endif
@@ -85,9 +288,10 @@ void l2_cache_probe(L2_Cache_State *l2, struct Cache_Block *b) {
   for (int way = 0; way < l2->num_ways; ++way) {
     block = set + way;
     if (block->valid && (block->tag == tag)) {
-      debug_l2("[0x%X] HIT in set %d way %d\n", tag, set_idx, way);
+      trace_event(l2->trace, TRACE_L2, TRACE_L2_HIT, tag, set_idx << 8 | way);
       /* promote block to MRU position */
       write_block(block, tag, l2->timestamp);
+      stat_inc(l2->stat_hits);
       /* send cache block back to L1 */
       interconnect_l2_to_l1(l2->interconnect, b);
       return;
@@ -95,46 +299,99 @@ void l2_cache_probe(L2_Cache_State *l2, struct Cache_Block *b) {
   }
 
   /* addr not in cache */
-  debug_l2("[0x%X] MISS in set %d\n", tag, set_idx);
+  trace_event(l2->trace, TRACE_L2, TRACE_L2_MISS, tag, set_idx);
 
   /* check if MSHR for tag already exists */
-  for (int i = 0; i < L2_MSHR_SIZE; ++i) {
-    L2_MSHR *mshr = l2->mshrs + i;
-    // Notice for every data structure, they access the address to the cache
-    // block!!!
-    if (!mshr->done && cache_block_equal(mshr->cache_block, b)) {
+  L2_MSHR *mshr = find_mshr(l2, tag);
+  if (mshr) {
+    int i = (int)(mshr - l2->mshrs);
+    if (find_target(mshr, b->l1)) {
       /* MSHR already allocated -> done */
-      debug_l2("[0x%X] MSHR already allocated\n", tag);
+      trace_event(l2->trace, TRACE_L2, TRACE_L2_MSHR_PENDING, tag, i);
+      free(b);
       return;
     }
-  }
-
-  /* no MSHR exists for this req -> allocate one and send request to memory */
-  for (int i = 0; i < L2_MSHR_SIZE; ++i) {
-    // traverse through every mshr of the cache
-    L2_MSHR *mshr = l2->mshrs + i;
-    if (mshr->done) {
-      mshr->valid = true;
-      mshr->done = false;
-      mshr->cache_block = b;
-      l2->mshr_count++;
-      debug_l2("[0x%X] MSHR allocated\n", tag);
-      interconnect_l2_to_mem(l2->interconnect, b);
+    /* no target left -> wait for the line to fill L2 and hit then */
+    if (!target_free(l2, mshr, b)) {
+      block_request(l2, b);
       return;
     }
+
+    /* the other L1 missed on the line first, or this one cancelled its
+     * request and asks again -> share the memory request */
+    trace_event(l2->trace, TRACE_L2, TRACE_L2_MSHR_MERGE, tag, i);
+    stat_inc(l2->stat_merged);
+    L2_MSHR_Target *target = mshr->targets + mshr->num_targets++;
+    target->cache_block = b;
+    target->valid = true;
+    return;
   }
 
-  /* no MSHR available -> should not happen */
-  // From the spec, we can know that this should never happens. Thus we can
-  // assert it. This is a common pattern in C programming, to ensure the
+  /* no MSHR exists for this req -> allocate one and send request to memory */
+  int i = mshr_first_free(l2);
+  // From the spec, we can know that a free MSHR exists (L1 had a credit). We
+  // can assert it. This is a common pattern in C programming, to ensure the
   // correctness of the program
-  assert(0);
+  assert(i >= 0);
+
+  mshr = l2->mshrs + i;
+  mshr->tag = tag;
+  mshr->targets[0].cache_block = b;
+  mshr->targets[0].valid = true;
+  mshr->num_targets = 1;
+  mshr->done = false;
+  mshr_set_free(l2, i, false);
+  l2->mshr_index[mshr_slot(l2, tag)] = i;
+  l2->mshr_count++;
+  stat_inc(l2->stat_misses);
+  Profile_Entry *e = profile_entry(l2->profile, b->pc);
+  if (e)
+    e->l2_misses++;
+  trace_event(l2->trace, TRACE_L2, TRACE_L2_MSHR_ALLOC, tag, i);
+  interconnect_l2_to_mem(l2->interconnect, b);
 }
 
-void l2_insert_block(L2_Cache_State *c, Cache_Block *b) {
-  c->timestamp++;
+// A repeated probe for a block that is already waiting on an MSHR (or in the
+// blocked queue) only bumps the timestamp, which leaves the LRU order as is.
+// Used to detect cycles in which L1 just keeps re-probing a miss.
+bool l2_cache_probe_idle(L2_Cache_State *l2, Cache_Block *b) {
+#if DEBUG_L2_ALWAYS_HIT
+  return false;
+#endif
 
-  uint32_t tag = b->tag;
+  if (find_blocked(l2, b))
+    return true;
+  if (l2->mshr_count >= l2->num_mshrs)
+    return false;
+
+  uint32_t set_idx = get_set_idx(l2, b->tag);
+  L2_Cache_Block *set = l2->blocks + set_idx * l2->num_ways;
+
+  for (int way = 0; way < l2->num_ways; ++way) {
+    if (set[way].valid && set[way].tag == b->tag)
+      return false;
+  }
+
+  L2_MSHR *mshr = find_mshr(l2, b->tag);
+  if (mshr)
+    return find_target(mshr, b->l1) != NULL;
+
+  return false;
+}
+
+void l2_cycle(L2_Cache_State *c) {
+  stat_sample(c->stat_mshr_occupancy, c->mshr_count, 1);
+  if (mshrs_exhausted(c))
+    stat_inc(c->stat_blocked_cycles);
+}
+
+void l2_skip_cycles(L2_Cache_State *c, int n) {
+  stat_sample(c->stat_mshr_occupancy, c->mshr_count, n);
+  if (mshrs_exhausted(c))
+    stat_add(c->stat_blocked_cycles, n);
+}
+
+static void insert_tag(L2_Cache_State *c, uint32_t tag) {
   uint32_t set_idx = get_set_idx(c, tag);
   L2_Cache_Block *set = c->blocks + set_idx * c->num_ways;
   L2_Cache_Block *block;
@@ -143,17 +400,17 @@ void l2_insert_block(L2_Cache_State *c, Cache_Block *b) {
   for (int way = 0; way < c->num_ways; ++way) {
     block = set + way;
     if (block->valid && (block->tag == tag))
-      goto out;
+      return;
   }
 
   /* try to insert into invalid block */
   for (int way = 0; way < c->num_ways; ++way) {
     block = set + way;
     if (!block->valid) {
-      debug_l2("[0x%X] inserted (invalid) into set %d way %d\n", tag, set_idx,
-               way);
+      trace_event(c->trace, TRACE_L2, TRACE_L2_INSERT, tag,
+                  set_idx << 8 | way);
       write_block(block, tag, c->timestamp);
-      goto out;
+      return;
     }
   }
 
@@ -166,40 +423,159 @@ void l2_insert_block(L2_Cache_State *c, Cache_Block *b) {
     }
   }
 
-  // Using this helps debugging and is extremely helpful
-  debug_l2("[0x%X] inserted (lru) in set %d way %d\n", tag, set_idx,
-           (int)(block - set));
+  // Tracing this helps debugging and is extremely helpful
+  trace_event(c->trace, TRACE_L2, TRACE_L2_INSERT, tag,
+              set_idx << 8 | (int)(block - set));
   /* add at MRU position */
   write_block(block, tag, c->timestamp);
+}
 
-out:
-  /* free MSHR */
-  for (int i = 0; i < L2_MSHR_SIZE; ++i) {
-    L2_MSHR *mshr = c->mshrs + i;
-    if (!mshr->done && cache_block_equal(mshr->cache_block, b)) {
-      if (mshr->valid) {
-        /* insert into L1 if MSHR was not cancelled before */
-        interconnect_l2_to_l1_no_latency(c->interconnect, b);
+// Replays the blocked probes, in the order they came in, as long as MSHRs are
+// free; a probe that still can't be served goes back to the end of the queue
+static void wake_blocked(L2_Cache_State *c) {
+  int n = c->blocked_requests->len;
+
+  while (n-- > 0 && c->mshr_count < c->num_mshrs) {
+    list_node_t *node = list_lpop(c->blocked_requests);
+    Cache_Block *b = (Cache_Block *)node->val;
+    LIST_FREE(node);
+    l2_cache_probe(c, b);
+  }
+}
+
+void l2_insert_block(L2_Cache_State *c, Cache_Block *b) {
+  c->timestamp++;
+
+  insert_tag(c, b->tag);
+
+  /* free MSHR, b is the block of its first target */
+  uint32_t slot = mshr_slot(c, b->tag);
+  if (c->mshr_index[slot] >= 0) {
+    L2_MSHR *mshr = c->mshrs + c->mshr_index[slot];
+    for (int i = 0; i < mshr->num_targets; ++i) {
+      L2_MSHR_Target *target = mshr->targets + i;
+      if (target->valid) {
+        /* insert into L1 if its request was not cancelled before */
+        interconnect_l2_to_l1_no_latency(c->interconnect, target->cache_block);
       } else {
-        free(b);
+        free(target->cache_block);
       }
+    }
 
-      mshr->valid = false;
-      mshr->done = true;
-      c->mshr_count--;
+    mshr->num_targets = 0;
+    mshr->done = true;
+    mshr_set_free(c, (int)(mshr - c->mshrs), true);
+    mshr_index_remove(c, slot);
+    c->mshr_count--;
+    wake_blocked(c);
+  }
+}
+
+// Functional access used while fast-forwarding, no MSHRs involved
+void l2_cache_warm(L2_Cache_State *c, uint32_t tag) {
+  c->timestamp++;
+
+  L2_Cache_Block *set = c->blocks + get_set_idx(c, tag) * c->num_ways;
+  for (int way = 0; way < c->num_ways; ++way) {
+    if (set[way].valid && set[way].tag == tag) {
+      write_block(set + way, tag, c->timestamp);
       return;
     }
   }
+
+  insert_tag(c, tag);
+}
+
+void l2_cache_save(L2_Cache_State *c, Checkpoint *ck) {
+  int num_mshrs = c->num_mshrs, mshr_targets = c->mshr_targets;
+
+  checkpoint_write_value(ck, c->num_sets);
+  checkpoint_write_value(ck, c->num_ways);
+  checkpoint_write_value(ck, c->timestamp);
+  checkpoint_write(ck, c->blocks,
+                   c->num_sets * c->num_ways * sizeof(L2_Cache_Block));
+
+  checkpoint_write_value(ck, num_mshrs);
+  checkpoint_write_value(ck, mshr_targets);
+  checkpoint_write_value(ck, c->mshr_count);
+  for (int i = 0; i < c->num_mshrs; ++i) {
+    L2_MSHR *mshr = c->mshrs + i;
+    checkpoint_write_value(ck, mshr->done);
+    checkpoint_write_value(ck, mshr->tag);
+    /* a served MSHR has no targets */
+    checkpoint_write_value(ck, mshr->num_targets);
+    for (int t = 0; t < mshr->num_targets; ++t) {
+      checkpoint_write_value(ck, mshr->targets[t].valid);
+      checkpoint_write_block(ck, mshr->targets[t].cache_block);
+    }
+  }
+
+  unsigned int num_blocked = c->blocked_requests->len;
+  checkpoint_write_value(ck, num_blocked);
+  list_node_t *node;
+  list_iterator_t *it = list_iterator_new(c->blocked_requests, LIST_HEAD);
+  while ((node = list_iterator_next(it)))
+    checkpoint_write_block(ck, (Cache_Block *)node->val);
+  list_iterator_destroy(it);
+}
+
+void l2_cache_restore(L2_Cache_State *c, Checkpoint *ck) {
+  int num_sets, num_ways, num_mshrs, mshr_targets;
+
+  checkpoint_read_value(ck, num_sets);
+  checkpoint_read_value(ck, num_ways);
+  if (num_sets != c->num_sets || num_ways != c->num_ways) {
+    printf("Error: checkpoint has a different L2 geometry\n");
+    exit(-1);
+  }
+  checkpoint_read_value(ck, c->timestamp);
+  checkpoint_read(ck, c->blocks,
+                  c->num_sets * c->num_ways * sizeof(L2_Cache_Block));
+
+  checkpoint_read_value(ck, num_mshrs);
+  checkpoint_read_value(ck, mshr_targets);
+  if (num_mshrs != c->num_mshrs || mshr_targets != c->mshr_targets) {
+    printf("Error: checkpoint has a different number of L2 MSHRs\n");
+    exit(-1);
+  }
+  checkpoint_read_value(ck, c->mshr_count);
+  for (int i = 0; i < c->num_mshrs; ++i) {
+    L2_MSHR *mshr = c->mshrs + i;
+    checkpoint_read_value(ck, mshr->done);
+    checkpoint_read_value(ck, mshr->tag);
+    checkpoint_read_value(ck, mshr->num_targets);
+    if (mshr->num_targets < 0 || mshr->num_targets > c->mshr_targets) {
+      printf("Error: checkpoint is corrupt\n");
+      exit(-1);
+    }
+    for (int t = 0; t < mshr->num_targets; ++t) {
+      checkpoint_read_value(ck, mshr->targets[t].valid);
+      mshr->targets[t].cache_block = checkpoint_read_block(ck);
+    }
+  }
+  mshr_file_reset(c);
+
+  unsigned int num_blocked;
+  checkpoint_read_value(ck, num_blocked);
+  for (unsigned int i = 0; i < num_blocked; ++i)
+    list_rpush(c->blocked_requests, list_node_new(checkpoint_read_block(ck)));
 }
 
 // Used for interconection, which is like the design pattern, adapter pattern
 void l2_cancel_cache_access(L2_Cache_State *l2, Cache_Block *b) {
   // The cancellation comes from the l1 cache, where it stems from the branch flush
-  for (int i = 0; i < L2_MSHR_SIZE; ++i) {
-    L2_MSHR *mshr = l2->mshrs + i;
-    if (!mshr->done && cache_block_equal(mshr->cache_block, b)) {
-      /* invalidate MSHR from initial L1 cache and tag */
-      mshr->valid = false;
-    }
+  L2_MSHR *mshr = find_mshr(l2, b->tag);
+  if (mshr) {
+    /* invalidate the request of that L1 only, the memory request stays */
+    L2_MSHR_Target *target = find_target(mshr, b->l1);
+    if (target)
+      target->valid = false;
+  }
+
+  /* a blocked probe is dropped altogether */
+  list_node_t *node = find_blocked(l2, b);
+  if (node) {
+    free(node->val);
+    list_remove(l2->blocked_requests, node);
   }
 }
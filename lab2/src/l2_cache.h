@@ -3,7 +3,9 @@
 
 #include "common.h"
 #include "interconnect.h"
+#include "list.h"
 
+/* default number of MSHRs (-m) */
 #define L2_MSHR_SIZE 16
 
 // Give different name to the same accessing data structure
@@ -17,14 +19,34 @@ typedef struct L2_Cache_Block {
   int last_access;
 } L2_Cache_Block;
 
-// MSHR entry
-typedef struct L2_MSHR {
+/* L1s that share the L2, the I$ and the D$ */
+#define L2_NUM_L1S 2
+
+/* default number of requests an MSHR holds for its line (-M): one per L1.
+ * An L1 that cancelled its request and asks again takes one of the targets
+ * beyond that and gets the fill; without a spare target it waits for the
+ * line to fill L2 and hits there (L2-to-L1 latency on top) */
+#define L2_MSHR_TARGETS 2
+
+// An L1 request waiting on an MSHR
+typedef struct L2_MSHR_Target {
   /* cache block */
   // storing the address of the cache block, here it simply stores the ptr to the target cache block
   // since cache block is a struct, it is passed by reference, it also contains more information about the cache block
   Cache_Block *cache_block;
-  /* indicates if MSHR is valid (i.e. L1 request was not cancelled) */
+  /* indicates if the target is valid (i.e. L1 request was not cancelled) */
   bool valid;
+} L2_MSHR_Target;
+
+// MSHR entry, for a line; the misses of both L1s on it share the one memory
+// request, which carries the block of the first target. An L1 has at most one
+// valid target, the ones before it were cancelled
+typedef struct L2_MSHR {
+  /* line address */
+  uint32_t tag;
+  /* L1 requests that get the fill */
+  L2_MSHR_Target *targets;
+  int num_targets;
   /* indicates if MSHR was served */
   bool done;
 } L2_MSHR;
@@ -45,28 +67,65 @@ struct L2_Cache_State {
   /* ptr to cache blocks */
   L2_Cache_Block *blocks;
   /* miss status holding register */
-  L2_MSHR mshrs[L2_MSHR_SIZE];
-  /* num of allocated MSHRs */
+  L2_MSHR *mshrs;
+  int num_mshrs;
+  /* targets an MSHR can hold, in one array for all of them */
+  int mshr_targets;
+  L2_MSHR_Target *targets;
+  /* MSHR file index: an open-addressed table (linear probing, power of two
+   * size, at most half full) of the allocated MSHRs by line address, -1 in
+   * empty slots; plus a bitmap of the free MSHRs. Lookups and allocations
+   * cost the same whatever the number of MSHRs */
+  int *mshr_index;
+  int mshr_index_bits;
+  uint64_t *mshr_free;
+  /* num of allocated MSHRs, the free ones are the credits of the L1s */
   int mshr_count; // Helps simplify the determine logic for the MSHR
+  /* probes that can't be served yet (no credit left, their line's MSHR has
+   * no target left) wait here in order and are replayed once an MSHR frees */
+  list_t *blocked_requests;
   /* ptr to interconnect */
   Interconnect_State *interconnect;
+  /* stats */
+  Stat *stat_hits, *stat_misses, *stat_mshr_occupancy;
+  Stat *stat_blocked, *stat_blocked_cycles, *stat_merged;
+  /* misses are also charged to the PC that caused them */
+  Profile *profile;
+  Trace *trace;
 };
 
-/* initialize a cache with the ususal values */
-void l2_cache_init(L2_Cache_State *c, Interconnect_State *interconnect);
+/* initialize a cache with the ususal values and num_mshrs MSHRs of
+ * mshr_targets targets each, registers the "l2" stats */
+void l2_cache_init(L2_Cache_State *c, int num_mshrs, int mshr_targets,
+                   Interconnect_State *interconnect, Stats *stats,
+                   Profile *profile, Trace *trace);
 
 /* free memory used by cache */
 void l2_cache_free(L2_Cache_State *c);
 
-/* probe L2 cache */
+/* probe L2 cache with b, which L2 keeps or frees; a block for the line
+ * always comes back to L1 unless the access gets cancelled */
 void l2_cache_probe(L2_Cache_State *c, Cache_Block *b);
 
-/* simulate one cycle for L2 cache */
-// void l2_cycle(L2_Cache_State *c);
+/* true if probing L2 with b would neither hit nor allocate an MSHR */
+bool l2_cache_probe_idle(L2_Cache_State *c, Cache_Block *b);
+
+/* simulate one cycle for L2 cache (only samples the stats) */
+void l2_cycle(L2_Cache_State *c);
+
+/* same as n calls to l2_cycle */
+void l2_skip_cycles(L2_Cache_State *c, int n);
 
 /* insert block into L2 cache */
 void l2_insert_block(L2_Cache_State *l2, Cache_Block *b);
 
+/* access without timing (fast-forward): hit or fill the block directly */
+void l2_cache_warm(L2_Cache_State *c, uint32_t tag);
+
+/* write/read blocks, MSHRs and blocked probes to/from a checkpoint */
+void l2_cache_save(L2_Cache_State *c, Checkpoint *ck);
+void l2_cache_restore(L2_Cache_State *c, Checkpoint *ck);
+
 /* cancel cache access from L1 cache */
 void l2_cancel_cache_access(L2_Cache_State *l2, Cache_Block *b);
 
@@ -1,14 +1,45 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "checkpoint.h"
+#include "event_queue.h"
 #include "memory.h"
-
-void memory_init(Memory_State *m, Interconnect_State *i)
+#include "profile.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
+
+void memory_init(Memory_State *m, Interconnect_State *i, Event_Queue *events,
+                 Stats *stats, Profile *profile, Trace *trace,
+                 Timeline *timeline)
 {
   m->interconnect = i;
+  m->events = events;
   m->pending_requests = list_new();
   m->ongoing_requests = list_new();
+
+  m->stat_cycles = stats_counter(stats, "dram", "cycles");
+  m->stat_requests = stats_counter(stats, "dram", "requests");
+  /* the row buffer status of each request as it gets scheduled */
+  m->stat_row_status[MEM_ROW_BUFFER_HIT] =
+      stats_counter(stats, "dram", "row_hits");
+  m->stat_row_status[MEM_ROW_BUFFER_MISS] =
+      stats_counter(stats, "dram", "row_misses");
+  m->stat_row_status[MEM_ROW_BUFFER_CONFLICT] =
+      stats_counter(stats, "dram", "row_conflicts");
+  /* the data bus is reserved for the whole transfer once scheduled */
+  m->stat_data_bus_cycles = stats_counter(stats, "dram", "data_bus_cycles");
+  stats_ratio(stats, "dram", "data_bus_utilization", m->stat_data_bus_cycles,
+              m->stat_cycles);
+  /* queue lengths at the end of every cycle */
+  m->stat_pending = stats_histogram(stats, "dram", "pending_requests",
+                                   MEM_STAT_MAX_PENDING + 1, 1);
+  m->stat_ongoing = stats_average(stats, "dram", "ongoing_requests");
+  m->profile = profile;
+  m->trace = trace;
+  m->timeline = timeline;
 }
 
 void memory_free(Memory_State *m)
@@ -34,6 +65,80 @@ void memory_free(Memory_State *m)
   list_destroy(m->ongoing_requests);
 }
 
+static void memory_save_requests(list_t *requests, Checkpoint *ck)
+{
+  unsigned int len = requests->len;
+  checkpoint_write_value(ck, len);
+
+  list_node_t *node;
+  list_iterator_t *it = list_iterator_new(requests, LIST_HEAD);
+  while ((node = list_iterator_next(it)))
+  {
+    Memory_Request *r = (Memory_Request *)node->val;
+    checkpoint_write_block(ck, r->cache_block);
+    checkpoint_write_value(ck, r->row);
+    checkpoint_write_value(ck, r->status);
+    checkpoint_write_value(ck, r->cmd_ints);
+    checkpoint_write_value(ck, r->data_int);
+    checkpoint_write_value(ck, r->bank_idx);
+    checkpoint_write_value(ck, r->bank_int);
+  }
+  list_iterator_destroy(it);
+}
+
+static void memory_restore_requests(Memory_State *m, list_t *requests,
+                                    Checkpoint *ck)
+{
+  unsigned int len;
+  checkpoint_read_value(ck, len);
+
+  for (unsigned int n = 0; n < len; ++n)
+  {
+    Memory_Request *r = (Memory_Request *)malloc(sizeof(Memory_Request));
+    r->cache_block = checkpoint_read_block(ck);
+    checkpoint_read_value(ck, r->row);
+    checkpoint_read_value(ck, r->status);
+    checkpoint_read_value(ck, r->cmd_ints);
+    checkpoint_read_value(ck, r->data_int);
+    checkpoint_read_value(ck, r->bank_idx);
+    checkpoint_read_value(ck, r->bank_int);
+    assert(r->bank_idx >= 0 && r->bank_idx < MEM_NUM_BANKS);
+    r->bank = m->banks + r->bank_idx;
+    list_rpush(requests, list_node_new(r));
+  }
+}
+
+void memory_save(Memory_State *m, Checkpoint *ck)
+{
+  checkpoint_write_value(ck, m->banks);
+  checkpoint_write_value(ck, m->curr_cycle);
+  memory_save_requests(m->pending_requests, ck);
+  memory_save_requests(m->ongoing_requests, ck);
+}
+
+static void memory_request_done(void *m, void *r);
+
+// expects a freshly initialized memory with empty queues
+void memory_restore(Memory_State *m, Checkpoint *ck)
+{
+  checkpoint_read_value(ck, m->banks);
+  checkpoint_read_value(ck, m->curr_cycle);
+  memory_restore_requests(m, m->pending_requests, ck);
+  memory_restore_requests(m, m->ongoing_requests, ck);
+
+  /* the ongoing requests retire in the order they were scheduled */
+  list_node_t *node;
+  list_iterator_t *it = list_iterator_new(m->ongoing_requests, LIST_TAIL);
+  while ((node = list_iterator_next(it)))
+  {
+    Memory_Request *r = (Memory_Request *)node->val;
+    assert(r->data_int.end >= m->curr_cycle);
+    event_schedule(m->events, r->data_int.end - m->curr_cycle, EVENT_DRAM,
+                   memory_request_done, m, r);
+  }
+  list_iterator_destroy(it);
+}
+
 void memory_add_request(Memory_State *m, Cache_Block *b)
 {
   // Instantiated an empty memory request
@@ -54,7 +159,8 @@ void memory_add_request(Memory_State *m, Cache_Block *b)
 
   // push the request to the pending request queue
   list_lpush(m->pending_requests, list_node_new(request));
-  debug_mem("[0x%X] memory request added\n", tag);
+  stat_inc(m->stat_requests);
+  trace_event(m->trace, TRACE_MEM, TRACE_MEM_REQUEST, tag, bank_idx);
 }
 
 static enum Memory_Row_Buffer_Status memory_get_rb_status(Memory_Request *r)
@@ -125,17 +231,33 @@ static void memory_calculate_usages(Memory_Request *r, int curr_cycle)
     r->data_int.end = r->data_int.start +
                       49; // Once hit, it needs to occupy the bus for 50 cycles
     r->data_int.valid = true;
+  }
+}
+
+static const char *memory_cmd_names[MEM_NUM_CMD_INTERVALS] = {
+    "PRECHARGE", "ACTIVATE", "READ/WRITE"};
+static const char *memory_row_status_names[] = {"row hit", "row miss",
+                                                "row conflict"};
 
-    // useful debugging logging to display the information of the memory request
-    debug_mem("[0x%X] ", r->cache_block->tag);
-    if (precharge_int->valid)
-      debug_mem("PRECHARGE [%d,%d] ", precharge_int->start, precharge_int->end);
-    if (activate_int->valid)
-      debug_mem("ACTIVATE [%d,%d] ", activate_int->start, activate_int->end);
-    debug_mem("READ/WRITE [%d,%d] DATA [%d,%d] BANK %d [%d,%d]\n",
-              read_write_int->start, read_write_int->end, r->data_int.start,
-              r->data_int.end, r->bank_idx, r->bank_int.start, r->bank_int.end);
+// The bank is busy for the whole request, its commands nest inside
+static void memory_timeline_request(Memory_State *m, Memory_Request *r)
+{
+  uint32_t addr = r->cache_block->tag;
+
+  timeline_dram(m->timeline, r->bank_idx, memory_row_status_names[r->status],
+                addr, r->bank_int.start, r->bank_int.end);
+  for (int c = 0; c < MEM_NUM_CMD_INTERVALS; ++c)
+  {
+    Memory_Interval *cmd = r->cmd_ints + c;
+    if (!cmd->valid)
+      continue;
+    timeline_dram(m->timeline, r->bank_idx, memory_cmd_names[c], addr,
+                  cmd->start, cmd->end);
+    timeline_dram(m->timeline, TIMELINE_CMD_BUS, memory_cmd_names[c], addr,
+                  cmd->start, cmd->end);
   }
+  timeline_dram(m->timeline, TIMELINE_DATA_BUS, "DATA", addr, r->data_int.start,
+                r->data_int.end);
 }
 
 static bool memory_intervals_overlap(Memory_Interval a, Memory_Interval b)
@@ -211,34 +333,35 @@ out:
   return result;
 }
 
-void memory_cycle(Memory_State *m)
+// Event of an ongoing request whose data transfer is over, it runs in the
+// cycle in which curr_cycle reaches the end of the transfer
+static void memory_request_done(void *arg, void *data)
 {
-  // This runs and process the on going request and pending request of
-  // the memory state. Memory state has banks, current cycle, pending requests
-  // and ongoing requests.
-  list_node_t *node;
-  list_iterator_t *it;
+  Memory_State *m = (Memory_State *)arg;
+  Memory_Request *r = (Memory_Request *)data;
 
-  /* First process the ongoing requests */
-  // Copies the ongoing requests to the iterator to prevent overwriting the
-  // requests This is a very common pattern in C programming to prevent bug
-  it = list_iterator_new(m->ongoing_requests, LIST_TAIL);
-  while ((node = list_iterator_next(it)))
-  {
-    // Extracts the info from the queue
-    Memory_Request *r = (Memory_Request *)node->val;
+  // The request is done, send the block back to l2 through the interconnect
+  trace_event(m->trace, TRACE_MEM, TRACE_MEM_DONE, r->cache_block->tag,
+              r->bank_idx);
+  interconnect_mem_to_l2(m->interconnect, r->cache_block);
 
-    // If the end of the request is less than or equal to the current cycle
-    if (r->data_int.end <= m->curr_cycle)
-    {
-      // If the request is done, then interconnect the memory to the l2
-      // cache,sends the block back to l2
-      interconnect_mem_to_l2(m->interconnect, r->cache_block);
-      free(r);
-      list_remove(m->ongoing_requests, node);
-    }
-  }
+  list_node_t *node;
+  list_iterator_t *it = list_iterator_new(m->ongoing_requests, LIST_TAIL);
+  while ((node = list_iterator_next(it)) && node->val != r)
+    ;
   list_iterator_destroy(it);
+  assert(node != NULL);
+  list_remove(m->ongoing_requests, node);
+  free(r);
+}
+
+void memory_cycle(Memory_State *m)
+{
+  // This schedules a pending request of the memory state. Memory state has
+  // banks, current cycle, pending requests and ongoing requests; the ongoing
+  // requests that are done were retired by their events before this
+  list_node_t *node;
+  list_iterator_t *it;
 
   /* find request to schedule fr-fcfs*/
   list_node_t *best_request_node = NULL;
@@ -270,14 +393,120 @@ void memory_cycle(Memory_State *m)
   if (best_request_node != NULL)
   {
     Memory_Request *r = (Memory_Request *)best_request_node->val;
-    debug_mem("scheduled request for 0x%X in cycle %d\n", r->cache_block->tag,
-              m->curr_cycle);
+    trace_event(m->trace, TRACE_MEM, TRACE_MEM_SCHEDULE, r->cache_block->tag,
+                r->status << 8 | r->bank_idx);
+    if (timeline_enabled(m->timeline))
+      memory_timeline_request(m, r);
     // Removes the best request from the pending request queue, put it into
     // ongoing request queue
     list_lpush(m->ongoing_requests, list_node_new(r));
     list_remove(m->pending_requests, best_request_node);
+    event_schedule(m->events, r->data_int.end - m->curr_cycle, EVENT_DRAM,
+                   memory_request_done, m, r);
+
+    stat_inc(m->stat_row_status[r->status]);
+    if (r->status == MEM_ROW_BUFFER_CONFLICT)
+    {
+      Profile_Entry *e = profile_entry(m->profile, r->cache_block->pc);
+      if (e)
+        e->row_conflicts++;
+    }
+    stat_add(m->stat_data_bus_cycles, r->data_int.end - r->data_int.start + 1);
   }
   list_iterator_destroy(it);
 
+  stat_inc(m->stat_cycles);
+  stat_sample(m->stat_pending, m->pending_requests->len, 1);
+  stat_sample(m->stat_ongoing, m->ongoing_requests->len, 1);
+
   m->curr_cycle++;
 }
+
+/*
+ * Shift cycle forward past the window in which interval r (computed for cycle
+ * 0) would overlap the ongoing interval o, i.e. cycle in [o.start - r.end,
+ * o.end - r.start]. Returns true if cycle was moved.
+ */
+static bool memory_skip_overlap(Memory_Interval o, Memory_Interval r,
+                                int *cycle)
+{
+  if (*cycle >= o.start - r.end && *cycle <= o.end - r.start)
+  {
+    *cycle = o.end - r.start + 1;
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Earliest cycle >= m->curr_cycle in which r becomes a candidate, given that
+ * the ongoing requests stay the same. The usages of r only depend on the
+ * cycle by an offset, so the check against each ongoing request boils down to
+ * a set of forbidden windows which are skipped until none of them applies.
+ */
+static int memory_next_candidate_cycle(Memory_State *m, Memory_Request *r)
+{
+  Memory_Request probe = *r;
+  probe.status = memory_get_rb_status(&probe);
+  memory_calculate_usages(&probe, 0);
+
+  int cycle = m->curr_cycle;
+  bool moved = true;
+  while (moved)
+  {
+    moved = false;
+    list_node_t *node;
+    list_iterator_t *it = list_iterator_new(m->ongoing_requests, LIST_TAIL);
+    while ((node = list_iterator_next(it)))
+    {
+      Memory_Request *o = (Memory_Request *)node->val;
+      for (int i = 0; i < MEM_NUM_CMD_INTERVALS; ++i)
+      {
+        if (!o->cmd_ints[i].valid)
+          continue;
+        for (int j = 0; j < MEM_NUM_CMD_INTERVALS; ++j)
+        {
+          if (probe.cmd_ints[j].valid)
+            moved |= memory_skip_overlap(o->cmd_ints[i], probe.cmd_ints[j],
+                                         &cycle);
+        }
+      }
+      moved |= memory_skip_overlap(o->data_int, probe.data_int, &cycle);
+      if (o->bank_idx == probe.bank_idx)
+        moved |= memory_skip_overlap(o->bank_int, probe.bank_int, &cycle);
+    }
+    list_iterator_destroy(it);
+  }
+  return cycle;
+}
+
+// Ongoing requests retire through their events, which the event queue
+// accounts for
+int memory_idle_cycles(Memory_State *m)
+{
+  int next = INT_MAX;
+  list_node_t *node;
+
+  /* a pending request gets scheduled as soon as it is a candidate */
+  list_iterator_t *it = list_iterator_new(m->pending_requests, LIST_TAIL);
+  while ((node = list_iterator_next(it)) && next > m->curr_cycle)
+  {
+    int cycle = memory_next_candidate_cycle(m, (Memory_Request *)node->val);
+    if (cycle < next)
+      next = cycle;
+  }
+  list_iterator_destroy(it);
+
+  if (next == INT_MAX)
+    return INT_MAX;
+  return next > m->curr_cycle ? next - m->curr_cycle : 0;
+}
+
+void memory_skip_cycles(Memory_State *m, int n)
+{
+  stat_add(m->stat_cycles, n);
+  stat_sample(m->stat_pending, m->pending_requests->len, n);
+  stat_sample(m->stat_ongoing, m->ongoing_requests->len, n);
+
+  m->curr_cycle += n;
+}
@@ -12,6 +12,9 @@
 #define MEM_ACT_IDX 1
 #define MEM_RW_IDX 2
 
+/* pending queue lengths up to this one get a histogram bucket of their own */
+#define MEM_STAT_MAX_PENDING 16
+
 typedef enum Memory_Row_Buffer_Status {
   // the possible status for row buffer
   MEM_ROW_BUFFER_HIT,
@@ -68,22 +71,46 @@ struct Memory_State {
   // This is being added to the pending request queue, and then being processed in the memory_cycle
   list_t *pending_requests;
   /* ongoing request queue */
-  // This serves as the queue for the ongoing requests
+  // This serves as the queue for the ongoing requests, each one retires
+  // through an event once its data transfer is over
   list_t *ongoing_requests;
+  Event_Queue *events;
   /* ptr to interconnect */
   Interconnect_State *interconnect;
+
+  /* stats */
+  Stat *stat_cycles, *stat_requests;
+  Stat *stat_row_status[MEM_ROW_BUFFER_CONFLICT + 1];
+  Stat *stat_data_bus_cycles, *stat_pending, *stat_ongoing;
+  /* row conflicts are also charged to the PC that caused them */
+  Profile *profile;
+  Trace *trace;
+  /* bank and bus intervals of every scheduled request */
+  Timeline *timeline;
 };
 
-/* init memory */
-void memory_init(Memory_State *m, Interconnect_State *i);
+/* init memory, registers the "dram" stats */
+void memory_init(Memory_State *m, Interconnect_State *i, Event_Queue *events,
+                 Stats *stats, Profile *profile, Trace *trace,
+                 Timeline *timeline);
 
 /* free storage allocated by memory */
 void memory_free(Memory_State *m);
 
+/* write/read banks and request queues to/from a checkpoint */
+void memory_save(Memory_State *m, Checkpoint *ck);
+void memory_restore(Memory_State *m, Checkpoint *ck);
+
 /* add a memory request */
 void memory_add_request(Memory_State *m, Cache_Block *b);
 
-/* retire ongoing requests and schedule a pending request */
+/* schedule a pending request (ongoing ones retire through their events) */
 void memory_cycle(Memory_State *m);
 
+/* number of upcoming cycles in which no pending request gets scheduled */
+int memory_idle_cycles(Memory_State *m);
+
+/* advance the memory clock by n idle cycles */
+void memory_skip_cycles(Memory_State *m, int n);
+
 #endif
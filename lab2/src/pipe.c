@@ -7,14 +7,23 @@
  */
 
 #include "pipe.h"
+#include "checkpoint.h"
 #include "debug.h"
+#include "event_queue.h"
+#include "host_profile.h"
 #include "interconnect.h"
+#include "konata.h"
 #include "l1_cache.h"
 #include "l2_cache.h"
 #include "memory.h"
 #include "mips.h"
+#include "profile.h"
 #include "shell.h"
+#include "sim.h"
+#include "stats.h"
+#include "timeline.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,120 +48,747 @@ void print_op(Pipe_Op *op)
     printf("(null)\n");
 }
 
-// States that must be propogated throughout the whole memory hierarchy
-Pipe_State pipe;
-L1_Cache_State inst_cache;
-L1_Cache_State data_cache;
-L2_Cache_State l2_cache;
-Memory_State memory;
-Interconnect_State interconnect;
+/* take a cleared op from the pool */
+static Pipe_Op *pipe_op_alloc()
+{
+  assert(sim->pipe.op_free_count > 0);
+  Pipe_Op *op = sim->pipe.op_free[--sim->pipe.op_free_count];
+  memset(op, 0, sizeof(Pipe_Op));
+  return op;
+}
+
+/* give an op back to the pool once it left the pipeline; a logged op that
+ * did not retire was squashed */
+static void pipe_op_free(Pipe_Op *op)
+{
+  int slot = op - sim->pipe.op_pool;
+  if (sim->pipe.op_konata_id[slot])
+  {
+    konata_leave(&sim->konata, sim->pipe.op_konata_id[slot],
+                 sim->pipe.op_konata_stage[slot], true);
+    sim->pipe.op_konata_id[slot] = 0;
+  }
+
+  assert(sim->pipe.op_free_count < PIPE_OP_POOL_SIZE);
+  sim->pipe.op_free[sim->pipe.op_free_count++] = op;
+}
+
+/* true if op has to wait in execute for a load in the miss queue: it reads or
+ * writes the load's destination register, or it is a syscall, which must not
+ * halt the machine before every load wrote its register */
+static bool pipe_miss_queue_blocks(Pipe_Op *op)
+{
+  bool syscall = op->opcode == OP_SPECIAL && op->subop == SUBOP_SYSCALL;
+
+  for (int i = 0; i < sim->pipe.num_misses; ++i)
+  {
+    Pipe_Op *load = sim->pipe.miss_queue[i].op;
+    if (!load || load->reg_dst <= 0)
+      continue;
+    if (syscall || op->reg_src1 == load->reg_dst ||
+        op->reg_src2 == load->reg_dst || op->reg_dst == load->reg_dst)
+      return true;
+  }
+  return false;
+}
+
+/* true if the store buffer already holds a write to the line of addr */
+static bool pipe_store_buffered(uint32_t addr)
+{
+  uint32_t tag = CACHE_BLOCK_ALIGNED_ADDR(addr);
+
+  for (int i = 0; i < sim->pipe.num_misses; ++i)
+  {
+    Pipe_Miss *m = sim->pipe.miss_queue + i;
+    if (!m->op && CACHE_BLOCK_ALIGNED_ADDR(m->addr) == tag)
+      return true;
+  }
+  return false;
+}
+
+/* true if the load or store in mem has to wait for a free miss queue entry;
+ * a hit needs none and a store that misses joins a buffered write to its
+ * line */
+static bool pipe_miss_queue_full(Pipe_Op *op)
+{
+  if (sim->pipe.num_misses < sim->dcache_miss_queue ||
+      l1_cache_contains(&sim->data_cache, op->mem_addr))
+    return false;
+  return !op->mem_write || !pipe_store_buffered(op->mem_addr);
+}
+
+static const char *pipe_cpi_names[PIPE_CPI_NUM] = {
+    "base", "icache", "dcache", "load_use", "multiplier", "branch", "other"};
+
+static void pipe_cpi_init()
+{
+  char group[64];
+
+  sim->pipe.decode_bubble = sim->pipe.execute_bubble = PIPE_CPI_OTHER;
+  sim->pipe.mem_bubble = sim->pipe.wb_bubble = PIPE_CPI_OTHER;
+
+  for (int c = 0; c < PIPE_CPI_NUM; ++c)
+    sim->pipe.stat_cpi[c] = stats_counter(&sim->stats, "cpi", pipe_cpi_names[c]);
+
+  for (int r = 0; r < sim->num_pc_ranges; ++r)
+  {
+    snprintf(group, sizeof(group), "cpi.0x%08x-0x%08x",
+             sim->pc_ranges[r].start, sim->pc_ranges[r].end);
+    for (int c = 0; c < PIPE_CPI_NUM; ++c)
+      sim->pipe.stat_cpi_range[r][c] =
+          stats_counter(&sim->stats, group, pipe_cpi_names[c]);
+  }
+}
+
+/* PC of the next op to retire, i.e. the one the pipeline waits for */
+static uint32_t pipe_oldest_pc()
+{
+  /* the loads in the miss queue are older than the op in mem */
+  Pipe_Op *queued = NULL;
+  for (int i = 0; i < sim->pipe.num_misses && !queued; ++i)
+    queued = sim->pipe.miss_queue[i].op;
+
+  Pipe_Op *oldest = sim->pipe.wb_op        ? sim->pipe.wb_op
+                    : queued               ? queued
+                    : sim->pipe.mem_op     ? sim->pipe.mem_op
+                    : sim->pipe.execute_op ? sim->pipe.execute_op
+                                           : sim->pipe.decode_op;
+  return oldest ? oldest->pc : sim->pipe.PC;
+}
+
+/* charge n cycles to category, to the PC ranges that hold pc and to pc in the
+ * profile */
+static void pipe_cpi_charge(Pipe_Cpi_Category category, uint32_t pc, int n)
+{
+  Profile_Entry *e = profile_entry(&sim->profile, pc);
+  if (e)
+  {
+    if (category == PIPE_CPI_BASE)
+      e->executions += n;
+    else
+      e->stall_cycles += n;
+  }
+
+  stat_add(sim->pipe.stat_cpi[category], n);
+  for (int r = 0; r < sim->num_pc_ranges; ++r)
+  {
+    if (pc >= sim->pc_ranges[r].start && pc <= sim->pc_ranges[r].end)
+      stat_add(sim->pipe.stat_cpi_range[r][category], n);
+  }
+}
+
+// Charges n skipped cycles the way the stages would: no op moves, so the
+// bubbles only flow down and settle after one cycle per stage
+static void pipe_cpi_skip(int n)
+{
+  uint32_t pc = pipe_oldest_pc();
+
+  for (int i = 0; i < n; ++i)
+  {
+    if (i == 4)
+    {
+      pipe_cpi_charge(sim->pipe.wb_bubble, pc, n - i);
+      break;
+    }
+    pipe_cpi_charge(sim->pipe.wb_bubble, pc, 1);
+
+    /* a stalled stage keeps its op, an empty one passes its bubble on */
+    sim->pipe.wb_bubble =
+        sim->pipe.mem_op ? PIPE_CPI_DCACHE : sim->pipe.mem_bubble;
+    if (!sim->pipe.mem_op)
+      sim->pipe.mem_bubble =
+          !sim->pipe.execute_op ? sim->pipe.execute_bubble
+          : pipe_miss_queue_blocks(sim->pipe.execute_op) ? PIPE_CPI_DCACHE
+                                                         : PIPE_CPI_MULTIPLIER;
+    if (!sim->pipe.execute_op)
+      sim->pipe.execute_bubble = sim->pipe.decode_bubble;
+    if (!sim->pipe.decode_op)
+      sim->pipe.decode_bubble = PIPE_CPI_ICACHE;
+  }
+}
+
+void pipe_cpi_report(FILE *out)
+{
+  uint64_t retired = sim->pipe.stat_cpi[PIPE_CPI_BASE]->value;
+  uint64_t cycles = 0;
+
+  for (int c = 0; c < PIPE_CPI_NUM; ++c)
+    cycles += sim->pipe.stat_cpi[c]->value;
+
+  fprintf(out, "CPI stack: %llu cycles, %llu retired, CPI %.3f\n",
+          (unsigned long long)cycles, (unsigned long long)retired,
+          retired ? (double)cycles / retired : 0.0);
+  fprintf(out, "  %-12s %12s %8s %7s\n", "", "cycles", "CPI", "share");
+  for (int c = 0; c < PIPE_CPI_NUM; ++c)
+  {
+    uint64_t n = sim->pipe.stat_cpi[c]->value;
+    fprintf(out, "  %-12s %12llu %8.3f %6.1f%%\n", pipe_cpi_names[c],
+            (unsigned long long)n, retired ? (double)n / retired : 0.0,
+            cycles ? 100.0 * n / cycles : 0.0);
+  }
+
+  for (int r = 0; r < sim->num_pc_ranges; ++r)
+  {
+    Stat **stat = sim->pipe.stat_cpi_range[r];
+    uint64_t range_cycles = 0, range_retired = stat[PIPE_CPI_BASE]->value;
+
+    for (int c = 0; c < PIPE_CPI_NUM; ++c)
+      range_cycles += stat[c]->value;
+
+    fprintf(out, "\nPCs 0x%08x-0x%08x: %llu cycles, %llu retired, CPI %.3f\n",
+            sim->pc_ranges[r].start, sim->pc_ranges[r].end,
+            (unsigned long long)range_cycles,
+            (unsigned long long)range_retired,
+            range_retired ? (double)range_cycles / range_retired : 0.0);
+    for (int c = 0; c < PIPE_CPI_NUM; ++c)
+    {
+      uint64_t n = stat[c]->value;
+      fprintf(out, "  %-12s %12llu %8.3f %6.1f%%\n", pipe_cpi_names[c],
+              (unsigned long long)n,
+              range_retired ? (double)n / range_retired : 0.0,
+              range_cycles ? 100.0 * n / range_cycles : 0.0);
+    }
+  }
+  fprintf(out, "\n");
+}
+
+/* log the stage each op moved to in the last cycle */
+static void pipe_konata_sample()
+{
+  static const char *stages[] = {"D", "X", "M", "W"};
+  Pipe_Op *ops[] = {sim->pipe.decode_op, sim->pipe.execute_op,
+                    sim->pipe.mem_op, sim->pipe.wb_op};
+
+  konata_cycle(&sim->konata, sim->pipe.cycle_count);
+  for (int s = 0; s < 4; ++s)
+  {
+    if (!ops[s])
+      continue;
+    int slot = ops[s] - sim->pipe.op_pool;
+    uint64_t id = sim->pipe.op_konata_id[slot];
+    if (id && sim->pipe.op_konata_stage[slot] != stages[s])
+    {
+      konata_stage(&sim->konata, id, sim->pipe.op_konata_stage[slot],
+                   stages[s]);
+      sim->pipe.op_konata_stage[slot] = stages[s];
+    }
+  }
+}
+
+/* the instruction fetch was trying to get is dropped */
+static void pipe_konata_drop_fetch()
+{
+  if (sim->pipe.fetch_konata_id)
+    konata_leave(&sim->konata, sim->pipe.fetch_konata_id, "F", true);
+  sim->pipe.fetch_konata_id = 0;
+}
+
+/* what the stages and the hierarchy hold from the next cycle on */
+static void pipe_timeline_sample()
+{
+  Timeline *t = &sim->timeline;
+  Pipe_Op *ops[TIMELINE_NUM_STAGES] = {sim->pipe.decode_op,
+                                       sim->pipe.execute_op, sim->pipe.mem_op,
+                                       sim->pipe.wb_op};
+  int cycle = sim->pipe.cycle_count;
+
+  for (int s = 0; s < TIMELINE_NUM_STAGES; ++s)
+    timeline_stage(t, s, ops[s], ops[s] ? ops[s]->pc : 0, cycle);
+  timeline_counter(t, TIMELINE_IN_FLIGHT, interconnect_in_flight(&sim->interconnect),
+                   cycle);
+  timeline_counter(t, TIMELINE_MSHRS, sim->l2_cache.mshr_count, cycle);
+}
 
 void pipe_init()
 {
-  memset(&pipe, 0, sizeof(Pipe_State));
-  pipe.PC = 0x00400000;
+  memset(&sim->pipe, 0, sizeof(Pipe_State));
+  sim->pipe.PC = 0x00400000;
+
+  for (int i = 0; i < PIPE_OP_POOL_SIZE; ++i)
+    pipe_op_free(sim->pipe.op_pool + i);
+
+  sim->pipe.decode_cache =
+      (Pipe_Decoded *)calloc(PIPE_DECODE_CACHE_SIZE, sizeof(Pipe_Decoded));
+
+  Stats *stats = &sim->stats;
+  Stat *cycles = stats_value(stats, "pipe", "cycles", &sim->stat_cycles);
+  Stat *retired = stats_value(stats, "pipe", "retired", &sim->stat_inst_retire);
+  stats_value(stats, "pipe", "fetched", &sim->stat_inst_fetch);
+  stats_value(stats, "pipe", "flushes", &sim->stat_squash);
+  stats_value(stats, "pipe", "fast_forwarded", &sim->stat_inst_ffwd);
+  stats_ratio(stats, "pipe", "ipc", retired, cycles);
+  pipe_cpi_init();
+
+  event_queue_init(&sim->events);
+
+  memory_init(&sim->memory, &sim->interconnect, &sim->events, stats,
+              &sim->profile, &sim->trace, &sim->timeline);
+
+  l2_cache_init(&sim->l2_cache, sim->l2_mshrs, sim->l2_mshr_targets,
+                &sim->interconnect, stats, &sim->profile, &sim->trace);
+
+  l1_cache_init(&sim->inst_cache, "L1 (inst)", "l1i", INST_CACHE_TOTAL_SIZE,
+                INST_CACHE_NUM_WAY, true, &sim->interconnect, stats,
+                &sim->profile, &sim->trace);
+
+  l1_cache_init(&sim->data_cache, "L1 (data)", "l1d", DATA_CACHE_TOTAL_SIZE,
+                DATA_CACHE_NUM_WAY, false, &sim->interconnect, stats,
+                &sim->profile, &sim->trace);
+
+  /* only a non-blocking D$ has a miss queue to count */
+  if (sim->dcache_miss_queue)
+  {
+    sim->pipe.stat_queued_loads = stats_counter(stats, "l1d", "queued_loads");
+    sim->pipe.stat_buffered_stores =
+        stats_counter(stats, "l1d", "buffered_stores");
+    sim->pipe.stat_hits_under_miss =
+        stats_counter(stats, "l1d", "hits_under_miss");
+    sim->pipe.stat_queue_full = stats_counter(stats, "l1d", "queue_full");
+    sim->pipe.stat_queue_occupancy = stats_histogram(
+        stats, "l1d", "queue_occupancy", sim->dcache_miss_queue + 1, 1);
+  }
+
+  interconnect_init(&sim->interconnect, &sim->l2_cache, &sim->memory,
+                    &sim->events, stats, &sim->trace);
+}
+
+static void pipe_free_hierarchy()
+{
+  l1_cache_free(&sim->inst_cache);
+  l1_cache_free(&sim->data_cache);
+  l2_cache_free(&sim->l2_cache);
+  memory_free(&sim->memory);
+  event_queue_free(&sim->events);
+}
+
+void pipe_free()
+{
+  /* a halted pipe already released the hierarchy */
+  if (sim->RUN_BIT)
+    pipe_free_hierarchy();
+  free(sim->pipe.decode_cache);
+  sim->pipe.decode_cache = NULL;
+}
+
+static void pipe_save_op(Checkpoint *ck, Pipe_Op *op)
+{
+  bool present = op != NULL;
+  checkpoint_write_value(ck, present);
+  if (present)
+    checkpoint_write(ck, op, sizeof(Pipe_Op));
+}
 
-  memory_init(&memory, &interconnect);
+static Pipe_Op *pipe_restore_op(Checkpoint *ck)
+{
+  bool present;
+  checkpoint_read_value(ck, present);
+  if (!present)
+    return NULL;
+
+  Pipe_Op *op = pipe_op_alloc();
+  checkpoint_read(ck, op, sizeof(Pipe_Op));
+  return op;
+}
 
-  l2_cache_init(&l2_cache, &interconnect);
+void pipe_save(Checkpoint *ck)
+{
+  pipe_save_op(ck, sim->pipe.decode_op);
+  pipe_save_op(ck, sim->pipe.execute_op);
+  pipe_save_op(ck, sim->pipe.mem_op);
+  pipe_save_op(ck, sim->pipe.wb_op);
+
+  checkpoint_write_value(ck, sim->pipe.REGS);
+  checkpoint_write_value(ck, sim->pipe.HI);
+  checkpoint_write_value(ck, sim->pipe.LO);
+  checkpoint_write_value(ck, sim->pipe.PC);
+  checkpoint_write_value(ck, sim->pipe.branch_recover);
+  checkpoint_write_value(ck, sim->pipe.branch_dest);
+  checkpoint_write_value(ck, sim->pipe.branch_flush);
+  checkpoint_write_value(ck, sim->pipe.multiplier_stall);
+  checkpoint_write_value(ck, sim->pipe.cycle_count);
+  checkpoint_write_value(ck, sim->pipe.decode_bubble);
+  checkpoint_write_value(ck, sim->pipe.execute_bubble);
+  checkpoint_write_value(ck, sim->pipe.mem_bubble);
+  checkpoint_write_value(ck, sim->pipe.wb_bubble);
+
+  checkpoint_write_value(ck, sim->dcache_miss_queue);
+  checkpoint_write_value(ck, sim->pipe.num_misses);
+  for (int i = 0; i < sim->pipe.num_misses; ++i)
+  {
+    Pipe_Miss *m = sim->pipe.miss_queue + i;
+    checkpoint_write_value(ck, m->addr);
+    checkpoint_write_value(ck, m->pc);
+    pipe_save_op(ck, m->op);
+  }
 
-  l1_cache_init(&inst_cache, "L1 (inst)", INST_CACHE_TOTAL_SIZE,
-                INST_CACHE_NUM_WAY, &interconnect);
+  l1_cache_save(&sim->inst_cache, ck);
+  l1_cache_save(&sim->data_cache, ck);
+  l2_cache_save(&sim->l2_cache, ck);
+  memory_save(&sim->memory, ck);
+  interconnect_save(&sim->interconnect, ck);
+}
 
-  l1_cache_init(&data_cache, "L1 (data)", DATA_CACHE_TOTAL_SIZE,
-                DATA_CACHE_NUM_WAY, &interconnect);
+void pipe_restore(Checkpoint *ck)
+{
+  /* rebuild the hierarchy from scratch */
+  pipe_free();
+  pipe_init();
+
+  sim->pipe.decode_op = pipe_restore_op(ck);
+  sim->pipe.execute_op = pipe_restore_op(ck);
+  sim->pipe.mem_op = pipe_restore_op(ck);
+  sim->pipe.wb_op = pipe_restore_op(ck);
+
+  checkpoint_read_value(ck, sim->pipe.REGS);
+  checkpoint_read_value(ck, sim->pipe.HI);
+  checkpoint_read_value(ck, sim->pipe.LO);
+  checkpoint_read_value(ck, sim->pipe.PC);
+  checkpoint_read_value(ck, sim->pipe.branch_recover);
+  checkpoint_read_value(ck, sim->pipe.branch_dest);
+  checkpoint_read_value(ck, sim->pipe.branch_flush);
+  checkpoint_read_value(ck, sim->pipe.multiplier_stall);
+  checkpoint_read_value(ck, sim->pipe.cycle_count);
+  /* the bubbles in flight keep the category they would have been charged */
+  checkpoint_read_value(ck, sim->pipe.decode_bubble);
+  checkpoint_read_value(ck, sim->pipe.execute_bubble);
+  checkpoint_read_value(ck, sim->pipe.mem_bubble);
+  checkpoint_read_value(ck, sim->pipe.wb_bubble);
+
+  /* the queue size is fixed at init like the cache geometry */
+  int miss_queue;
+  checkpoint_read_value(ck, miss_queue);
+  if (miss_queue != sim->dcache_miss_queue)
+  {
+    printf("Error: checkpoint has a different D$ miss queue\n");
+    exit(-1);
+  }
+  checkpoint_read_value(ck, sim->pipe.num_misses);
+  if (sim->pipe.num_misses < 0 || sim->pipe.num_misses > miss_queue)
+  {
+    printf("Error: checkpoint has too many D$ misses queued\n");
+    exit(-1);
+  }
+  for (int i = 0; i < sim->pipe.num_misses; ++i)
+  {
+    Pipe_Miss *m = sim->pipe.miss_queue + i;
+    checkpoint_read_value(ck, m->addr);
+    checkpoint_read_value(ck, m->pc);
+    m->op = pipe_restore_op(ck);
+  }
 
-  interconnect_init(&interconnect, &l2_cache, &memory);
+  l1_cache_restore(&sim->inst_cache, ck);
+  l1_cache_restore(&sim->data_cache, ck);
+  l2_cache_restore(&sim->l2_cache, ck);
+  memory_restore(&sim->memory, ck);
+  interconnect_restore(&sim->interconnect, ck);
 }
 
 void pipe_cycle()
 {
 #if DEBUG
-  printf("\n\n----\n\nPIPELINE (cycle %d):\n", pipe.cycle_count);
+  printf("\n\n----\n\nPIPELINE (cycle %d):\n", sim->pipe.cycle_count);
   printf("DCODE: ");
-  print_op(pipe.decode_op);
+  print_op(sim->pipe.decode_op);
   printf("EXEC : ");
-  print_op(pipe.execute_op);
+  print_op(sim->pipe.execute_op);
   printf("MEM  : ");
-  print_op(pipe.mem_op);
+  print_op(sim->pipe.mem_op);
   printf("WB   : ");
-  print_op(pipe.wb_op);
+  print_op(sim->pipe.wb_op);
   printf("\n");
 #endif
 
-  // process the requests within the interconnection first
-  interconnect_cycle(&interconnect);
+  /* one cycle in every host profile interval gets timed part by part */
+  Host_Profile *host = &sim->host_profile;
+  bool timed = host_profile_sample(host);
+  uint64_t now = timed ? host_profile_now() : 0;
+
+  if (konata_enabled(&sim->konata))
+    pipe_konata_sample();
+  if (timed)
+    now = host_profile_charge(host, HOST_OTHER, now);
+
+  // process the requests within the interconnection first, then the
+  // DRAM requests that are done; both are events due in this cycle
+  interconnect_cycle(&sim->interconnect);
+  event_run(&sim->events);
+  if (timed)
+    now = host_profile_charge(host, HOST_INTERCONNECT, now);
   // process memory cycles
-  memory_cycle(&memory);
+  memory_cycle(&sim->memory);
+  if (timed)
+    now = host_profile_charge(host, HOST_DRAM, now);
+  l2_cycle(&sim->l2_cache);
+  if (timed)
+    now = host_profile_charge(host, HOST_L2, now);
 
   pipe_stage_wb();
+  if (timed)
+    now = host_profile_charge(host, HOST_WB, now);
   pipe_stage_mem();
+  if (timed)
+    now = host_profile_charge(host, HOST_MEM, now);
   pipe_stage_execute();
+  if (timed)
+    now = host_profile_charge(host, HOST_EXECUTE, now);
   pipe_stage_decode();
+  if (timed)
+    now = host_profile_charge(host, HOST_DECODE, now);
   pipe_stage_fetch();
+  if (timed)
+    now = host_profile_charge(host, HOST_FETCH, now);
 
   /* handle branch recoveries */
-  if (pipe.branch_recover)
+  if (sim->pipe.branch_recover)
   {
 #if DEBUG
-    printf("branch recovery: new dest %08x flush %d stages\n", pipe.branch_dest,
-           pipe.branch_flush);
+    printf("branch recovery: new dest %08x flush %d stages\n",
+           sim->pipe.branch_dest, sim->pipe.branch_flush);
 #endif
     // During the branch recovery, the cache access should be canceled, thus one has to call the function
     // propogates the information down to memory hierarchy to disable the $ access
-    l1_cancel_cache_access(&inst_cache, pipe.PC);
+    l1_cancel_cache_access(&sim->inst_cache, sim->pipe.PC);
+    pipe_konata_drop_fetch();
 
-    pipe.PC = pipe.branch_dest;
+    sim->pipe.PC = sim->pipe.branch_dest;
 
-    if (pipe.branch_flush >= 2)
+    if (sim->pipe.branch_flush >= 2)
     {
-      if (pipe.decode_op)
-        free(pipe.decode_op);
-      pipe.decode_op = NULL;
+      if (sim->pipe.decode_op)
+        pipe_op_free(sim->pipe.decode_op);
+      sim->pipe.decode_op = NULL;
+      sim->pipe.decode_bubble = PIPE_CPI_BRANCH;
     }
 
-    if (pipe.branch_flush >= 3)
+    if (sim->pipe.branch_flush >= 3)
     {
-      if (pipe.execute_op)
-        free(pipe.execute_op);
-      pipe.execute_op = NULL;
+      if (sim->pipe.execute_op)
+        pipe_op_free(sim->pipe.execute_op);
+      sim->pipe.execute_op = NULL;
+      sim->pipe.execute_bubble = PIPE_CPI_BRANCH;
     }
 
-    if (pipe.branch_flush >= 4)
+    if (sim->pipe.branch_flush >= 4)
     {
-      if (pipe.mem_op)
+      if (sim->pipe.mem_op)
       {
-        l1_cancel_cache_access(&data_cache, pipe.mem_op->mem_addr);
-        free(pipe.mem_op);
+        l1_cancel_cache_access(&sim->data_cache, sim->pipe.mem_op->mem_addr);
+        pipe_op_free(sim->pipe.mem_op);
       }
-      pipe.mem_op = NULL;
+      sim->pipe.mem_op = NULL;
+      sim->pipe.mem_bubble = PIPE_CPI_BRANCH;
     }
 
-    if (pipe.branch_flush >= 5)
+    if (sim->pipe.branch_flush >= 5)
     {
-      if (pipe.wb_op)
-        free(pipe.wb_op);
-      pipe.wb_op = NULL;
+      if (sim->pipe.wb_op)
+        pipe_op_free(sim->pipe.wb_op);
+      sim->pipe.wb_op = NULL;
+      sim->pipe.wb_bubble = PIPE_CPI_BRANCH;
     }
 
-    pipe.branch_recover = 0;
-    pipe.branch_dest = 0;
-    pipe.branch_flush = 0;
+    sim->pipe.branch_recover = 0;
+    sim->pipe.branch_dest = 0;
+    sim->pipe.branch_flush = 0;
 
-    stat_squash++;
+    sim->stat_squash++;
   }
 
-  pipe.cycle_count++;
+  sim->pipe.cycle_count++;
+  event_advance(&sim->events, 1);
+
+  if (timeline_enabled(&sim->timeline))
+    pipe_timeline_sample();
+  if (timed)
+    host_profile_charge(host, HOST_OTHER, now);
 
   // Release the memory after the program is done
-  if (RUN_BIT == 0)
+  if (sim->RUN_BIT == 0)
+  {
+    /* stores still in the store buffer already wrote guest memory */
+    sim->pipe.num_misses = 0;
+    pipe_free_hierarchy();
+  }
+}
+
+/* number of upcoming cycles in which no pipeline stage can make progress */
+static int pipe_idle_cycles()
+{
+  int idle = INT_MAX;
+
+  /* writeback always retires its op */
+  if (sim->pipe.wb_op)
+    return 0;
+
+  /* a queued access moves on once its line is back (or is probed again) */
+  for (int i = 0; i < sim->pipe.num_misses; ++i)
+  {
+    if (!l1_cache_access_idle(&sim->data_cache, sim->pipe.miss_queue[i].addr))
+      return 0;
+  }
+
+  if (sim->pipe.mem_op)
   {
-    l1_cache_free(&inst_cache);
-    l1_cache_free(&data_cache);
-    l2_cache_free(&l2_cache);
-    memory_free(&memory);
-    interconnect_free(&interconnect);
+    /* only a D$ miss that is already in flight holds the mem stage, or with
+     * a non-blocking D$ a miss that finds the miss queue full */
+    Pipe_Op *op = sim->pipe.mem_op;
+    if (!op->is_mem)
+      return 0;
+    if (sim->dcache_miss_queue
+            ? !pipe_miss_queue_full(op)
+            : !l1_cache_access_idle(&sim->data_cache, op->mem_addr))
+      return 0;
   }
+  else if (sim->pipe.execute_op &&
+           !pipe_miss_queue_blocks(sim->pipe.execute_op))
+  {
+    /* with mem empty, execute only waits for the multiplier (or for a queued
+     * load, which the queue above bounds); the op leaves in the cycle that
+     * counts multiplier_stall down to zero */
+    Pipe_Op *op = sim->pipe.execute_op;
+    if (op->opcode != OP_SPECIAL ||
+        (op->subop != SUBOP_MFHI && op->subop != SUBOP_MTHI &&
+         op->subop != SUBOP_MFLO && op->subop != SUBOP_MTLO) ||
+        sim->pipe.multiplier_stall <= 1)
+      return 0;
+    idle = sim->pipe.multiplier_stall - 1;
+  }
+
+  if (sim->pipe.decode_op)
+  {
+    if (!sim->pipe.execute_op)
+      return 0;
+  }
+  else if (!l1_cache_access_idle(&sim->inst_cache, sim->pipe.PC))
+  {
+    return 0;
+  }
+
+  return idle;
+}
+
+int pipe_skip_idle_cycles(int max_cycles)
+{
+  int n = pipe_idle_cycles();
+  if (n == 0)
+    return 0;
+
+  int mem_idle = memory_idle_cycles(&sim->memory);
+  if (mem_idle < n)
+    n = mem_idle;
+  int event_idle = event_idle_cycles(&sim->events);
+  if (event_idle < n)
+    n = event_idle;
+  /* nothing is in flight that could wake the machine up again */
+  if (n == INT_MAX)
+    return 0;
+  if (max_cycles < n)
+    n = max_cycles;
+  if (n <= 0)
+    return 0;
+
+  event_advance(&sim->events, n);
+  interconnect_skip_cycles(&sim->interconnect, n);
+  memory_skip_cycles(&sim->memory, n);
+  l2_skip_cycles(&sim->l2_cache, n);
+  if (sim->dcache_miss_queue)
+  {
+    stat_sample(sim->pipe.stat_queue_occupancy, sim->pipe.num_misses, n);
+    if (sim->pipe.mem_op)
+      stat_add(sim->pipe.stat_queue_full, n);
+  }
+  pipe_cpi_skip(n);
+  sim->pipe.multiplier_stall =
+      sim->pipe.multiplier_stall > n ? sim->pipe.multiplier_stall - n : 0;
+  sim->pipe.cycle_count += n;
+
+  return n;
+}
+
+/* the loads in the miss queue already hold their values, as does a load in
+ * writeback that came from there, but they may be older than ops that
+ * retired; they retire now so that every op left in the stages is younger
+ * than all of the retired ones. Buffered stores already wrote guest memory. */
+static void pipe_miss_queue_drain()
+{
+  Pipe_Op *done[PIPE_MISS_QUEUE_SIZE + 1];
+  int num_done = 0;
+
+  for (int i = 0; i < sim->pipe.num_misses; ++i)
+  {
+    Pipe_Miss *m = sim->pipe.miss_queue + i;
+    l1_cancel_cache_access(&sim->data_cache, m->addr);
+    if (m->op)
+      done[num_done++] = m->op;
+  }
+  sim->pipe.num_misses = 0;
+  Pipe_Op *wb = sim->pipe.wb_op;
+  if (wb && wb->is_mem && !wb->mem_write)
+  {
+    done[num_done++] = wb;
+    sim->pipe.wb_op = NULL;
+  }
+
+  /* a queued load never shares its destination with a younger op, so the
+   * order of the register writes does not matter */
+  for (int i = 0; i < num_done; ++i)
+  {
+    int slot = done[i] - sim->pipe.op_pool;
+    if (sim->pipe.op_konata_id[slot])
+    {
+      konata_leave(&sim->konata, sim->pipe.op_konata_id[slot],
+                   sim->pipe.op_konata_stage[slot], false);
+      sim->pipe.op_konata_id[slot] = 0;
+    }
+    pipe_op_retire(done[i]);
+    pipe_op_free(done[i]);
+    sim->stat_inst_retire++;
+  }
+}
+
+void pipe_squash_all()
+{
+  if (sim->dcache_miss_queue)
+    pipe_miss_queue_drain();
+
+  Pipe_Op *oldest = sim->pipe.wb_op      ? sim->pipe.wb_op
+                    : sim->pipe.mem_op     ? sim->pipe.mem_op
+                    : sim->pipe.execute_op ? sim->pipe.execute_op
+                                      : sim->pipe.decode_op;
+
+  /* ops only update the register file in writeback, and re-executing a load
+   * or store that already accessed memory yields the same result; HI/LO are
+   * written in execute, so the oldest op that got past it restores them */
+  l1_cancel_cache_access(&sim->inst_cache, sim->pipe.PC);
+  pipe_konata_drop_fetch();
+  if (oldest)
+    sim->pipe.PC = oldest->pc;
+  Pipe_Op *executed = sim->pipe.wb_op ? sim->pipe.wb_op : sim->pipe.mem_op;
+  if (executed)
+  {
+    sim->pipe.HI = executed->hi_before;
+    sim->pipe.LO = executed->lo_before;
+  }
+
+  if (sim->pipe.decode_op)
+    pipe_op_free(sim->pipe.decode_op);
+  if (sim->pipe.execute_op)
+    pipe_op_free(sim->pipe.execute_op);
+  if (sim->pipe.mem_op)
+  {
+    if (sim->pipe.mem_op->is_mem)
+      l1_cancel_cache_access(&sim->data_cache, sim->pipe.mem_op->mem_addr);
+    pipe_op_free(sim->pipe.mem_op);
+  }
+  if (sim->pipe.wb_op)
+    pipe_op_free(sim->pipe.wb_op);
+
+  sim->pipe.decode_op = sim->pipe.execute_op = NULL;
+  sim->pipe.mem_op = sim->pipe.wb_op = NULL;
+  sim->pipe.multiplier_stall = 0;
+
+  sim->pipe.decode_bubble = sim->pipe.execute_bubble = PIPE_CPI_OTHER;
+  sim->pipe.mem_bubble = sim->pipe.wb_bubble = PIPE_CPI_OTHER;
 }
 
 void pipe_recover(int flush, uint32_t dest)
@@ -160,30 +796,51 @@ void pipe_recover(int flush, uint32_t dest)
   /* if there is already a recovery scheduled, it must have come from a later
    * stage (which executes older instructions), hence that recovery overrides
    * our recovery. Simply return in this case. */
-  if (pipe.branch_recover)
+  if (sim->pipe.branch_recover)
     return;
 
   /* schedule the recovery. This will be done once all pipeline stages simulate
    * the current cycle. */
-  pipe.branch_recover = 1;
-  pipe.branch_flush = flush;
-  pipe.branch_dest = dest;
+  sim->pipe.branch_recover = 1;
+  sim->pipe.branch_flush = flush;
+  sim->pipe.branch_dest = dest;
 }
 
 void pipe_stage_wb()
 {
   /* if there is no instruction in this pipeline stage, we are done */
-  if (!pipe.wb_op)
+  if (!sim->pipe.wb_op)
+  {
+    pipe_cpi_charge(sim->pipe.wb_bubble, pipe_oldest_pc(), 1);
     return;
+  }
 
   /* grab the op out of our input slot */
-  Pipe_Op *op = pipe.wb_op;
-  pipe.wb_op = NULL;
+  Pipe_Op *op = sim->pipe.wb_op;
+  sim->pipe.wb_op = NULL;
+  pipe_cpi_charge(PIPE_CPI_BASE, op->pc, 1);
+
+  int slot = op - sim->pipe.op_pool;
+  if (sim->pipe.op_konata_id[slot])
+  {
+    konata_leave(&sim->konata, sim->pipe.op_konata_id[slot], "W", false);
+    sim->pipe.op_konata_id[slot] = 0;
+  }
+
+  pipe_op_retire(op);
+
+  /* free the op */
+  pipe_op_free(op);
 
+  sim->stat_inst_retire++;
+}
+
+void pipe_op_retire(Pipe_Op *op)
+{
   /* if this instruction writes a register, do so now */
   if (op->reg_dst != -1 && op->reg_dst != 0)
   {
-    pipe.REGS[op->reg_dst] = op->reg_dst_value;
+    sim->pipe.REGS[op->reg_dst] = op->reg_dst_value;
 #if DEBUG
     printf("R%d = %08x\n", op->reg_dst, op->reg_dst_value);
 #endif
@@ -194,36 +851,132 @@ void pipe_stage_wb()
   {
     if (op->reg_src1_value == 0xA)
     {
-      pipe.PC = op->pc + 4; /* fetch could stall so we have to inc. PC */
-      RUN_BIT = 0;
+      sim->pipe.PC = op->pc + 4; /* fetch could stall so we have to inc. PC */
+      sim->RUN_BIT = 0;
     }
   }
+}
 
-  /* free the op */
-  free(op);
+/* one access in the miss queue whose line is back completes per cycle, the
+ * oldest one first; true if it was a load and took the writeback stage */
+static bool pipe_miss_queue_refill()
+{
+  for (int i = 0; i < sim->pipe.num_misses; ++i)
+  {
+    Pipe_Miss *m = sim->pipe.miss_queue + i;
+    if (l1_cache_access_idle(&sim->data_cache, m->addr))
+      continue;
+    /* a line evicted again before this access got it is probed again */
+    if (l1_cache_access(&sim->data_cache, m->addr, m->pc) == CACHE_MISS)
+      continue;
+
+    Pipe_Op *op = m->op;
+    memmove(m, m + 1, (--sim->pipe.num_misses - i) * sizeof(Pipe_Miss));
+    if (!op)
+      return false;
+    sim->pipe.wb_op = op;
+    return true;
+  }
+  return false;
+}
 
-  stat_inst_retire++;
+/* mem stage for a load or store with a non-blocking D$; a miss goes to the
+ * miss queue, so only a miss that finds the queue full holds the stage */
+static void pipe_stage_mem_nonblocking(Pipe_Op *op)
+{
+  L1_Cache_State *c = &sim->data_cache;
+  bool under_miss = sim->pipe.num_misses > 0;
+
+  if (pipe_miss_queue_full(op))
+  {
+    stat_inc(sim->pipe.stat_queue_full);
+    sim->pipe.wb_bubble = PIPE_CPI_DCACHE;
+    return;
+  }
+
+  /* guest memory is read and written here in program order, the queue only
+   * delays when the op is done */
+  pipe_op_mem(op);
+  sim->pipe.mem_op = NULL;
+
+  if (l1_cache_access(c, op->mem_addr, op->pc) == CACHE_HIT)
+  {
+    if (under_miss)
+      stat_inc(sim->pipe.stat_hits_under_miss);
+    sim->pipe.wb_op = op;
+    return;
+  }
+
+  if (op->mem_write)
+  {
+    /* the store retires, its write stays in the store buffer where writes
+     * to the same line are combined */
+    if (!pipe_store_buffered(op->mem_addr))
+    {
+      Pipe_Miss *m = sim->pipe.miss_queue + sim->pipe.num_misses++;
+      m->op = NULL;
+      m->addr = op->mem_addr;
+      m->pc = op->pc;
+    }
+    stat_inc(sim->pipe.stat_buffered_stores);
+    sim->pipe.wb_op = op;
+    return;
+  }
+
+  Pipe_Miss *m = sim->pipe.miss_queue + sim->pipe.num_misses++;
+  m->op = op;
+  m->addr = op->mem_addr;
+  m->pc = op->pc;
+  stat_inc(sim->pipe.stat_queued_loads);
+  sim->pipe.wb_bubble = PIPE_CPI_DCACHE;
 }
 
 void pipe_stage_mem()
 {
+  if (sim->dcache_miss_queue)
+  {
+    stat_sample(sim->pipe.stat_queue_occupancy, sim->pipe.num_misses, 1);
+    /* the op in mem waits while a load from the queue writes back */
+    if (pipe_miss_queue_refill())
+      return;
+  }
+
   /* if there is no instruction in this pipeline stage, we are done */
-  if (!pipe.mem_op)
+  if (!sim->pipe.mem_op)
+  {
+    sim->pipe.wb_bubble = sim->pipe.mem_bubble;
     return;
+  }
 
   /* grab the op out of our input slot */
-  Pipe_Op *op = pipe.mem_op;
+  Pipe_Op *op = sim->pipe.mem_op;
+
+  if (op->is_mem && sim->dcache_miss_queue)
+  {
+    pipe_stage_mem_nonblocking(op);
+    return;
+  }
 
+  /* both loads and stores read an addr so we stall pipeline only once */
+  if (op->is_mem &&
+      l1_cache_access(&sim->data_cache, op->mem_addr, op->pc) == CACHE_MISS)
+  {
+    sim->pipe.wb_bubble = PIPE_CPI_DCACHE;
+    return;
+  }
+  // gets the value only when it is cache hit, before it, the stage is stalled.
+  pipe_op_mem(op);
+
+  /* clear stage input and transfer to next stage */
+  sim->pipe.mem_op = NULL;
+  sim->pipe.wb_op = op;
+}
+
+void pipe_op_mem(Pipe_Op *op)
+{
   uint32_t val = 0;
   if (op->is_mem)
   {
-    /* both loads and stores read an addr so we stall pipeline only once */
-    if (l1_cache_access(&data_cache, op->mem_addr) == CACHE_MISS)
-    {
-      return;
-    }
-    // gets the value only when it is cache hit, before it, the stage is stalled.
-
     val = mem_read_32(op->mem_addr & ~3);
   }
 
@@ -320,29 +1073,28 @@ void pipe_stage_mem()
     mem_write_32(op->mem_addr & ~3, val);
     break;
   }
-
-  /* clear stage input and transfer to next stage */
-  pipe.mem_op = NULL;
-  pipe.wb_op = op;
 }
 
 void pipe_stage_execute()
 {
   /* if a multiply/divide is in progress, decrement cycles until value is ready
    */
-  if (pipe.multiplier_stall > 0)
-    pipe.multiplier_stall--;
+  if (sim->pipe.multiplier_stall > 0)
+    sim->pipe.multiplier_stall--;
 
   /* if downstream stall, return (and leave any input we had) */
-  if (pipe.mem_op != NULL)
+  if (sim->pipe.mem_op != NULL)
     return;
 
   /* if no op to execute, return */
-  if (pipe.execute_op == NULL)
+  if (sim->pipe.execute_op == NULL)
+  {
+    sim->pipe.mem_bubble = sim->pipe.execute_bubble;
     return;
+  }
 
   /* grab op and read sources */
-  Pipe_Op *op = pipe.execute_op;
+  Pipe_Op *op = sim->pipe.execute_op;
 
   /* read register values, and check for bypass; stall if necessary */
   int stall = 0;
@@ -350,44 +1102,75 @@ void pipe_stage_execute()
   {
     if (op->reg_src1 == 0)
       op->reg_src1_value = 0;
-    else if (pipe.mem_op && pipe.mem_op->reg_dst == op->reg_src1)
+    else if (sim->pipe.mem_op && sim->pipe.mem_op->reg_dst == op->reg_src1)
     {
-      if (!pipe.mem_op->reg_dst_value_ready)
+      if (!sim->pipe.mem_op->reg_dst_value_ready)
         stall = 1;
       else
-        op->reg_src1_value = pipe.mem_op->reg_dst_value;
+        op->reg_src1_value = sim->pipe.mem_op->reg_dst_value;
     }
-    else if (pipe.wb_op && pipe.wb_op->reg_dst == op->reg_src1)
+    else if (sim->pipe.wb_op && sim->pipe.wb_op->reg_dst == op->reg_src1)
     {
-      op->reg_src1_value = pipe.wb_op->reg_dst_value;
+      op->reg_src1_value = sim->pipe.wb_op->reg_dst_value;
     }
     else
-      op->reg_src1_value = pipe.REGS[op->reg_src1];
+      op->reg_src1_value = sim->pipe.REGS[op->reg_src1];
   }
   if (op->reg_src2 != -1)
   {
     if (op->reg_src2 == 0)
       op->reg_src2_value = 0;
-    else if (pipe.mem_op && pipe.mem_op->reg_dst == op->reg_src2)
+    else if (sim->pipe.mem_op && sim->pipe.mem_op->reg_dst == op->reg_src2)
     {
-      if (!pipe.mem_op->reg_dst_value_ready)
+      if (!sim->pipe.mem_op->reg_dst_value_ready)
         stall = 1;
       else
-        op->reg_src2_value = pipe.mem_op->reg_dst_value;
+        op->reg_src2_value = sim->pipe.mem_op->reg_dst_value;
     }
-    else if (pipe.wb_op && pipe.wb_op->reg_dst == op->reg_src2)
+    else if (sim->pipe.wb_op && sim->pipe.wb_op->reg_dst == op->reg_src2)
     {
-      op->reg_src2_value = pipe.wb_op->reg_dst_value;
+      op->reg_src2_value = sim->pipe.wb_op->reg_dst_value;
     }
     else
-      op->reg_src2_value = pipe.REGS[op->reg_src2];
+      op->reg_src2_value = sim->pipe.REGS[op->reg_src2];
   }
 
   /* if bypassing requires a stall (e.g. use immediately after load),
    * return without clearing stage input */
   if (stall)
+  {
+    sim->pipe.mem_bubble = PIPE_CPI_LOAD_USE;
+    return;
+  }
+
+  /* a load still waiting for its line in the non-blocking D$ holds only
+   * the ops that depend on its destination */
+  if (sim->pipe.num_misses && pipe_miss_queue_blocks(op))
+  {
+    sim->pipe.mem_bubble = PIPE_CPI_DCACHE;
     return;
+  }
+
+  /* HI/LO accesses stall until the multiplier is done */
+  op->hi_before = sim->pipe.HI;
+  op->lo_before = sim->pipe.LO;
+  if (!pipe_op_execute(op))
+  {
+    sim->pipe.mem_bubble = PIPE_CPI_MULTIPLIER;
+    return;
+  }
+
+  /* handle branch recoveries at this point */
+  if (op->branch_taken)
+    pipe_recover(3, op->branch_dest);
 
+  /* remove from upstream stage and place in downstream stage */
+  sim->pipe.execute_op = NULL;
+  sim->pipe.mem_op = op;
+}
+
+bool pipe_op_execute(Pipe_Op *op)
+{
   /* execute the op */
   switch (op->opcode)
   {
@@ -432,22 +1215,22 @@ void pipe_stage_execute()
       int64_t val = (int64_t)((int32_t)op->reg_src1_value) *
                     (int64_t)((int32_t)op->reg_src2_value);
       uint64_t uval = (uint64_t)val;
-      pipe.HI = (uval >> 32) & 0xFFFFFFFF;
-      pipe.LO = (uval >> 0) & 0xFFFFFFFF;
+      sim->pipe.HI = (uval >> 32) & 0xFFFFFFFF;
+      sim->pipe.LO = (uval >> 0) & 0xFFFFFFFF;
 
       /* four-cycle multiplier latency */
-      pipe.multiplier_stall = 4;
+      sim->pipe.multiplier_stall = 4;
     }
     break;
     case SUBOP_MULTU:
     {
       uint64_t val =
           (uint64_t)op->reg_src1_value * (uint64_t)op->reg_src2_value;
-      pipe.HI = (val >> 32) & 0xFFFFFFFF;
-      pipe.LO = (val >> 0) & 0xFFFFFFFF;
+      sim->pipe.HI = (val >> 32) & 0xFFFFFFFF;
+      sim->pipe.LO = (val >> 0) & 0xFFFFFFFF;
 
       /* four-cycle multiplier latency */
-      pipe.multiplier_stall = 4;
+      sim->pipe.multiplier_stall = 4;
     }
     break;
 
@@ -462,63 +1245,65 @@ void pipe_stage_execute()
         div = val1 / val2;
         mod = val1 % val2;
 
-        pipe.LO = div;
-        pipe.HI = mod;
+        sim->pipe.LO = div;
+        sim->pipe.HI = mod;
       }
       else
       {
         // really this would be a div-by-0 exception
-        pipe.HI = pipe.LO = 0;
+        sim->pipe.HI = sim->pipe.LO = 0;
       }
 
       /* 32-cycle divider latency */
-      pipe.multiplier_stall = 32;
+      sim->pipe.multiplier_stall = 32;
       break;
 
     case SUBOP_DIVU:
       if (op->reg_src2_value != 0)
       {
-        pipe.HI = (uint32_t)op->reg_src1_value % (uint32_t)op->reg_src2_value;
-        pipe.LO = (uint32_t)op->reg_src1_value / (uint32_t)op->reg_src2_value;
+        sim->pipe.HI =
+            (uint32_t)op->reg_src1_value % (uint32_t)op->reg_src2_value;
+        sim->pipe.LO =
+            (uint32_t)op->reg_src1_value / (uint32_t)op->reg_src2_value;
       }
       else
       {
         /* really this would be a div-by-0 exception */
-        pipe.HI = pipe.LO = 0;
+        sim->pipe.HI = sim->pipe.LO = 0;
       }
 
       /* 32-cycle divider latency */
-      pipe.multiplier_stall = 32;
+      sim->pipe.multiplier_stall = 32;
       break;
 
     case SUBOP_MFHI:
       /* stall until value is ready */
-      if (pipe.multiplier_stall > 0)
-        return;
+      if (sim->pipe.multiplier_stall > 0)
+        return false;
 
-      op->reg_dst_value = pipe.HI;
+      op->reg_dst_value = sim->pipe.HI;
       break;
     case SUBOP_MTHI:
       /* stall to respect WAW dependence */
-      if (pipe.multiplier_stall > 0)
-        return;
+      if (sim->pipe.multiplier_stall > 0)
+        return false;
 
-      pipe.HI = op->reg_src1_value;
+      sim->pipe.HI = op->reg_src1_value;
       break;
 
     case SUBOP_MFLO:
       /* stall until value is ready */
-      if (pipe.multiplier_stall > 0)
-        return;
+      if (sim->pipe.multiplier_stall > 0)
+        return false;
 
-      op->reg_dst_value = pipe.LO;
+      op->reg_dst_value = sim->pipe.LO;
       break;
     case SUBOP_MTLO:
       /* stall to respect WAW dependence */
-      if (pipe.multiplier_stall > 0)
-        return;
+      if (sim->pipe.multiplier_stall > 0)
+        return false;
 
-      pipe.LO = op->reg_src1_value;
+      sim->pipe.LO = op->reg_src1_value;
       break;
 
     case SUBOP_ADD:
@@ -636,29 +1421,12 @@ void pipe_stage_execute()
     break;
   }
 
-  /* handle branch recoveries at this point */
-  if (op->branch_taken)
-    pipe_recover(3, op->branch_dest);
-
-  /* remove from upstream stage and place in downstream stage */
-  pipe.execute_op = NULL;
-  pipe.mem_op = op;
+  return true;
 }
 
-void pipe_stage_decode()
+/* fills in the decoded fields of a freshly fetched op */
+static void pipe_decode_op(Pipe_Op *op)
 {
-  /* if downstream stall, return (and leave any input we had) */
-  if (pipe.execute_op != NULL)
-    return;
-
-  /* if no op to decode, return */
-  if (pipe.decode_op == NULL)
-    return;
-
-  /* grab op and remove from stage input */
-  Pipe_Op *op = pipe.decode_op;
-  pipe.decode_op = NULL;
-
   /* set up info fields (source/dest regs, immediate, jump dest) as necessary */
   uint32_t opcode = (op->instruction >> 26) & 0x3F;
   uint32_t rs = (op->instruction >> 21) & 0x1F;
@@ -785,37 +1553,101 @@ void pipe_stage_decode()
     }
     break;
   }
+}
+
+void pipe_decode_cache_invalidate(uint32_t addr)
+{
+  Pipe_Decoded *entry =
+      sim->pipe.decode_cache + ((addr >> 2) & (PIPE_DECODE_CACHE_SIZE - 1));
+  if (entry->valid && entry->op.pc == addr)
+    entry->valid = false;
+}
+
+void pipe_decode_cache_flush()
+{
+  memset(sim->pipe.decode_cache, 0,
+         PIPE_DECODE_CACHE_SIZE * sizeof(Pipe_Decoded));
+}
+
+void pipe_stage_decode()
+{
+  /* if downstream stall, return (and leave any input we had) */
+  if (sim->pipe.execute_op != NULL)
+    return;
+
+  /* if no op to decode, return */
+  if (sim->pipe.decode_op == NULL)
+  {
+    sim->pipe.execute_bubble = sim->pipe.decode_bubble;
+    return;
+  }
+
+  /* grab op and remove from stage input */
+  Pipe_Op *op = sim->pipe.decode_op;
+  sim->pipe.decode_op = NULL;
+
+  pipe_op_decode(op);
 
   /* we will handle reg-read together with bypass in the execute stage */
 
   /* place op in downstream slot */
-  pipe.execute_op = op;
+  sim->pipe.execute_op = op;
+}
+
+void pipe_op_decode(Pipe_Op *op)
+{
+  /* an op fresh from fetch only carries pc and instruction, so everything
+   * decode fills in is a function of the pc as long as the text is unchanged
+   */
+  Pipe_Decoded *entry =
+      sim->pipe.decode_cache + ((op->pc >> 2) & (PIPE_DECODE_CACHE_SIZE - 1));
+  if (entry->valid && entry->op.pc == op->pc)
+  {
+    *op = entry->op;
+  }
+  else
+  {
+    pipe_decode_op(op);
+    entry->op = *op;
+    entry->valid = true;
+  }
 }
 
 void pipe_stage_fetch()
 {
   /* if pipeline is stalled (our output slot is not empty), return */
-  if (pipe.decode_op != NULL)
+  if (sim->pipe.decode_op != NULL)
     return;
 
+  /* the instruction at PC starts fetch with its first I$ access */
+  if (konata_enabled(&sim->konata) && !sim->pipe.fetch_konata_id)
+    sim->pipe.fetch_konata_id = konata_fetch(&sim->konata, sim->pipe.PC,
+                                             mem_read_32(sim->pipe.PC));
+
   // I$ accessing
-  if (l1_cache_access(&inst_cache, pipe.PC) == CACHE_MISS)
+  if (l1_cache_access(&sim->inst_cache, sim->pipe.PC, sim->pipe.PC) ==
+      CACHE_MISS)
   {
     /* stall the pipeline on a cache miss */
+    sim->pipe.decode_bubble = PIPE_CPI_ICACHE;
     return;
   }
 
   /* Allocate an op and send it down the pipeline. */
-  Pipe_Op *op = (Pipe_Op *)malloc(sizeof(Pipe_Op));
-  memset(op, 0, sizeof(Pipe_Op));
+  Pipe_Op *op = pipe_op_alloc();
   op->reg_src1 = op->reg_src2 = op->reg_dst = -1;
 
-  op->instruction = mem_read_32(pipe.PC);
-  op->pc = pipe.PC;
+  op->instruction = mem_read_32(sim->pipe.PC);
+  op->pc = sim->pipe.PC;
+
+  int slot = op - sim->pipe.op_pool;
+  sim->pipe.op_konata_id[slot] = sim->pipe.fetch_konata_id;
+  sim->pipe.op_konata_stage[slot] = "F";
+  sim->pipe.fetch_konata_id = 0;
 
-  pipe.decode_op = op;
+  sim->pipe.decode_op = op;
 
-  if (RUN_BIT != 0)
+  if (sim->RUN_BIT != 0)
   {
     /*
      * update PC only if RUN_BIT is on
@@ -823,8 +1655,8 @@ void pipe_stage_fetch()
      * we modify PC in wb stage in case fetch stage is stalled
      * so for the last cycle PC has already increased.
      */
-    pipe.PC += 4;
+    sim->pipe.PC += 4;
   }
 
-  stat_inst_fetch++;
+  sim->stat_inst_fetch++;
 }
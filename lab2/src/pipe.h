@@ -9,7 +9,9 @@
 #ifndef _PIPE_H_
 #define _PIPE_H_
 
+#include "l1_cache.h"
 #include "shell.h"
+#include <stdbool.h>
 
 /* Pipeline ops (instances of this structure) are high-level representations of
  * the instructions that actually flow through the pipeline. This struct does
@@ -47,6 +49,10 @@ typedef struct Pipe_Op {
   uint32_t reg_dst_value; /* value to write into dest reg. */
   int reg_dst_value_ready; /* destination value produced yet? */
 
+  /* HI/LO as this op found them in execute, where mult/div/mthi/mtlo write
+   * them; squashing the op after that puts them back */
+  uint32_t hi_before, lo_before;
+
   /* branch information */
   int is_branch;        /* is this a branch? */
   uint32_t branch_dest; /* branch destination (if taken) */
@@ -58,6 +64,31 @@ typedef struct Pipe_Op {
 
 } Pipe_Op;
 
+/* decoded ops are cached by PC so hot code skips the field extraction */
+#define PIPE_DECODE_CACHE_SIZE 4096
+
+typedef struct Pipe_Decoded {
+  /* op as it leaves decode, op.pc is the tag */
+  Pipe_Op op;
+  bool valid;
+} Pipe_Decoded;
+
+/* Every cycle is charged to one category of the CPI stack: to base if an op
+ * retires, else to the reason the writeback stage is empty. An empty stage
+ * input (a bubble) carries the reason it was created and moves down the
+ * pipeline with it, e.g. a bubble fetch leaves on an I$ miss is charged to
+ * icache once it reaches writeback. */
+typedef enum Pipe_Cpi_Category {
+  PIPE_CPI_BASE,       /* an op retired */
+  PIPE_CPI_ICACHE,     /* fetch waited for the I$ */
+  PIPE_CPI_DCACHE,     /* mem waited for the D$ */
+  PIPE_CPI_LOAD_USE,   /* execute waited for a value being loaded */
+  PIPE_CPI_MULTIPLIER, /* execute waited for HI/LO */
+  PIPE_CPI_BRANCH,     /* ops squashed by a branch recovery */
+  PIPE_CPI_OTHER,      /* pipeline fill, e.g. at the start */
+  PIPE_CPI_NUM
+} Pipe_Cpi_Category;
+
 /* The pipe state represents the current state of the pipeline. It holds a
  * pointer to the op that is currently at the input of each stage. As stages
  * execute, they remove the op from their input (set the pointer to NULL) and
@@ -67,6 +98,25 @@ typedef struct Pipe_Op {
  * be lost).
  */
 
+/* Non-blocking D$ (-N): a load or store that misses leaves the mem stage for
+ * the miss queue instead of stalling the pipeline. A load waits there for its
+ * line and then takes the writeback stage, while only the ops that read or
+ * write its destination register wait in execute. A store retires at once and
+ * leaves its write behind in the queue, which is the store buffer. Every entry
+ * waits for one line of the L1 pending-miss table, so that bounds the queue. */
+#define PIPE_MISS_QUEUE_SIZE L1_PENDING_SIZE
+
+typedef struct Pipe_Miss {
+  /* the load, or NULL for the write of a store that already retired */
+  Pipe_Op *op;
+  uint32_t addr, pc;
+} Pipe_Miss;
+
+/* ops are recycled through a free list instead of malloc/free; at most one op
+ * sits in front of each of the four stages plus the one fetch is creating,
+ * and one waits in each entry of the miss queue */
+#define PIPE_OP_POOL_SIZE (8 + PIPE_MISS_QUEUE_SIZE)
+
 typedef struct Pipe_State {
   /* pipe op currently at the input of the given stage (NULL for none) */
   Pipe_Op *decode_op, *execute_op, *mem_op, *wb_op;
@@ -89,24 +139,90 @@ typedef struct Pipe_State {
   /* multiplier stall info */
   int multiplier_stall; /* number of remaining cycles until HI/LO are ready */
 
+  /* D$ accesses waiting for their line, oldest first (non-blocking D$ only) */
+  Pipe_Miss miss_queue[PIPE_MISS_QUEUE_SIZE];
+  int num_misses;
+
+  /* storage for all ops in flight and the stack of unused ones */
+  Pipe_Op op_pool[PIPE_OP_POOL_SIZE];
+  Pipe_Op *op_free[PIPE_OP_POOL_SIZE];
+  int op_free_count;
+
+  /* direct-mapped decoded instruction cache, indexed by PC */
+  Pipe_Decoded *decode_cache;
+
   /* place other information here as necessary */
   int cycle_count;
-} Pipe_State;
 
-/* global variable -- pipeline state */
-extern Pipe_State pipe;
+  /* per-instruction log: id of each op in the pool (0 if it isn't logged)
+   * and the stage it was last seen in, and of the instruction fetch is
+   * trying to get */
+  uint64_t op_konata_id[PIPE_OP_POOL_SIZE];
+  const char *op_konata_stage[PIPE_OP_POOL_SIZE];
+  uint64_t fetch_konata_id;
+
+  /* CPI stack: category of the bubble at the input of each stage, and the
+   * cycles charged to each category, overall and per PC range */
+  Pipe_Cpi_Category decode_bubble, execute_bubble, mem_bubble, wb_bubble;
+  Stat *stat_cpi[PIPE_CPI_NUM];
+  Stat *stat_cpi_range[MAX_PC_RANGES][PIPE_CPI_NUM];
+
+  /* non-blocking D$: loads and stores that went to the miss queue, accesses
+   * that hit while it was not empty, cycles the mem stage waited for a free
+   * entry, and the entries in use per cycle */
+  Stat *stat_queued_loads, *stat_buffered_stores, *stat_hits_under_miss;
+  Stat *stat_queue_full, *stat_queue_occupancy;
+} Pipe_State;
 
 /* called during simulator startup */
 void pipe_init();
 
+/* release everything pipe_init allocated */
+void pipe_free();
+
+/* write/read the pipeline and the whole memory hierarchy to/from a
+ * checkpoint; restore rebuilds the hierarchy from scratch */
+void pipe_save(Checkpoint *ck);
+void pipe_restore(Checkpoint *ck);
+
 /* this function calls the others */
 void pipe_cycle();
 
+/* fast-forward over cycles in which every stage is stalled and no event is
+ * due in the memory hierarchy; skips at most max_cycles and returns how many
+ * cycles were skipped (0 if the next cycle can change any state) */
+int pipe_skip_idle_cycles(int max_cycles);
+
+/* print the CPI stack of the run and of every PC range */
+void pipe_cpi_report(FILE *out);
+
+/* drop the decoded op cached for the instruction word at addr; called for
+ * every write to guest memory so self-modifying code stays correct */
+void pipe_decode_cache_invalidate(uint32_t addr);
+
+/* drop all decoded ops, e.g. after guest memory was replaced in bulk */
+void pipe_decode_cache_flush();
+
+/* squash every op in flight and rewind the fetch PC to the oldest one; HI/LO,
+ * the only state written before writeback, are rolled back as well, which
+ * leaves the architectural state as if execution stopped right before it */
+void pipe_squash_all();
+
 /* helper: pipe stages can call this to schedule a branch recovery */
 /* flushes 'flush' stages (1 = execute only, 2 = fetch/decode, ...) and then
  * sets the fetch PC to the given destination. */
 void pipe_recover(int flush, uint32_t dest);
 
+/* semantics of an op, shared by the stages and the functional engine */
+/* fill in the decoded fields of an op that carries pc and instruction */
+void pipe_op_decode(Pipe_Op *op);
+/* compute results from the source values; false if HI/LO are not ready */
+bool pipe_op_execute(Pipe_Op *op);
+/* perform the load or store of a memory op */
+void pipe_op_mem(Pipe_Op *op);
+/* write the destination register and handle syscalls */
+void pipe_op_retire(Pipe_Op *op);
+
 /* each of these functions implements one stage of the pipeline */
 void pipe_stage_fetch();
 void pipe_stage_decode();
@@ -0,0 +1,239 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+void profile_init(Profile *p, uint32_t start, uint32_t end) {
+  profile_free(p);
+  p->text_start = start;
+  p->num_entries = end > start ? (end - start + 3) / 4 : 0;
+  p->entries =
+      (Profile_Entry *)calloc(p->num_entries ? p->num_entries : 1,
+                              sizeof(Profile_Entry));
+}
+
+// The instruction on a line of assembly, without its comment and labels, or
+// NULL for a line that assembles to nothing (blank, label, directive)
+static char *profile_source_inst(char *line) {
+  char *end = strchr(line, '#');
+  if (end == NULL)
+    end = line + strlen(line);
+  while (end > line && isspace((unsigned char)end[-1]))
+    end--;
+  *end = '\0';
+
+  for (;;) {
+    while (isspace((unsigned char)*line))
+      line++;
+    char *colon = strchr(line, ':');
+    if (colon == NULL)
+      break;
+    line = colon + 1;
+  }
+
+  return *line == '\0' || *line == '.' ? NULL : line;
+}
+
+static bool profile_is_zero_reg(const char *reg) {
+  while (isspace((unsigned char)*reg))
+    reg++;
+  return strncmp(reg, "$0", 2) == 0 ? !isalnum((unsigned char)reg[2])
+                                    : strncmp(reg, "$zero", 5) == 0;
+}
+
+// Number of words the assembler emits for an instruction. Immediates that
+// don't fit 16 bits are built in $at first (lui/ori), from $zero that is all
+// an addiu needs
+static int profile_source_words(const char *inst) {
+  char mnemonic[16];
+  int n = 0;
+  const char *operands[3] = {NULL, NULL, NULL};
+  int num_operands = 0;
+
+  while (isalpha((unsigned char)inst[n]) && n < (int)sizeof(mnemonic) - 1) {
+    mnemonic[n] = inst[n];
+    n++;
+  }
+  mnemonic[n] = '\0';
+
+  for (const char *s = inst + n; s && num_operands < 3; num_operands++) {
+    operands[num_operands] = s;
+    s = strchr(s, ',');
+    if (s)
+      s++;
+  }
+  if (num_operands < 2)
+    return 1;
+
+  /* the immediate is the last operand */
+  char *end;
+  long long imm = strtoll(operands[num_operands - 1], &end, 0);
+  if (end == operands[num_operands - 1])
+    return 1;
+  while (isspace((unsigned char)*end))
+    end++;
+  if (*end != '\0' && *end != ',')
+    return 1;
+  bool fits_signed = imm >= -32768 && imm <= 32767;
+  bool fits_unsigned = imm >= 0 && imm <= 65535;
+
+  if (strcmp(mnemonic, "li") == 0)
+    return fits_signed || fits_unsigned ? 1 : 2;
+  if (strcmp(mnemonic, "lui") == 0)
+    return fits_unsigned ? 1 : 2;
+  if (strcmp(mnemonic, "addi") == 0 || strcmp(mnemonic, "addiu") == 0) {
+    if (fits_signed)
+      return 1;
+    return num_operands == 3 && profile_is_zero_reg(operands[1]) ? 2 : 3;
+  }
+  if (strcmp(mnemonic, "slti") == 0 || strcmp(mnemonic, "sltiu") == 0)
+    return fits_signed ? 1 : 3;
+  if (strcmp(mnemonic, "andi") == 0 || strcmp(mnemonic, "ori") == 0 ||
+      strcmp(mnemonic, "xori") == 0)
+    return fits_unsigned ? 1 : 3;
+  return 1;
+}
+
+static void profile_free_source(Profile *p) {
+  for (uint32_t i = 0; i < p->num_source_lines; ++i)
+    free(p->source_text[i]);
+  free(p->source_text);
+  free(p->source_lines);
+  free(p->source_file);
+  p->source_text = NULL;
+  p->source_lines = NULL;
+  p->source_file = NULL;
+  p->num_source_lines = 0;
+}
+
+void profile_load_source(Profile *p, const char *program_filename) {
+  char line[256];
+  int line_no = 0;
+  uint32_t max_lines = 0;
+
+  /* foo.x -> foo.s */
+  size_t len = strlen(program_filename);
+  if (len < 2 || strcmp(program_filename + len - 2, ".x") != 0)
+    return;
+  char *filename = strdup(program_filename);
+  filename[len - 1] = 's';
+
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    free(filename);
+    return;
+  }
+
+  profile_free_source(p);
+  p->source_file = filename;
+
+  while (fgets(line, sizeof(line), f)) {
+    line_no++;
+    line[strcspn(line, "\r\n")] = '\0';
+    char *inst = profile_source_inst(line);
+    if (inst == NULL)
+      continue;
+
+    /* every word of an expanded pseudo-instruction maps to its line */
+    for (int words = profile_source_words(inst); words > 0; --words) {
+      if (p->num_source_lines == max_lines) {
+        max_lines = max_lines ? 2 * max_lines : 256;
+        p->source_lines =
+            (int *)realloc(p->source_lines, max_lines * sizeof(int));
+        p->source_text =
+            (char **)realloc(p->source_text, max_lines * sizeof(char *));
+      }
+      p->source_lines[p->num_source_lines] = line_no;
+      p->source_text[p->num_source_lines] = strdup(inst);
+      p->num_source_lines++;
+    }
+  }
+  fclose(f);
+}
+
+/* qsort has no context argument, the entries being sorted are passed here */
+static _Thread_local Profile_Entry *profile_sort_entries;
+
+static int profile_compare(const void *a, const void *b) {
+  Profile_Entry *x = profile_sort_entries + *(const uint32_t *)a;
+  Profile_Entry *y = profile_sort_entries + *(const uint32_t *)b;
+
+  if (x->stall_cycles != y->stall_cycles)
+    return x->stall_cycles < y->stall_cycles ? 1 : -1;
+  if (x->executions != y->executions)
+    return x->executions < y->executions ? 1 : -1;
+  /* ties in text order */
+  return *(const uint32_t *)a < *(const uint32_t *)b ? -1 : 1;
+}
+
+bool profile_write(Profile *p, const char *filename) {
+  uint32_t *order =
+      (uint32_t *)malloc((p->num_entries + 1) * sizeof(uint32_t));
+  uint32_t n = 0;
+  Profile_Entry total;
+
+  memset(&total, 0, sizeof(total));
+  for (uint32_t i = 0; i < p->num_entries; ++i) {
+    Profile_Entry *e = p->entries + i;
+    if (!e->executions && !e->stall_cycles && !e->icache_misses &&
+        !e->dcache_misses && !e->l2_misses && !e->row_conflicts)
+      continue;
+    order[n++] = i;
+    total.executions += e->executions;
+    total.stall_cycles += e->stall_cycles;
+    total.icache_misses += e->icache_misses;
+    total.dcache_misses += e->dcache_misses;
+    total.l2_misses += e->l2_misses;
+    total.row_conflicts += e->row_conflicts;
+  }
+  profile_sort_entries = p->entries;
+  qsort(order, n, sizeof(uint32_t), profile_compare);
+
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    free(order);
+    return false;
+  }
+
+  fprintf(f, "# %u instructions, sorted by stall cycles%s%s\n", n,
+          p->source_file ? ", source " : "",
+          p->source_file ? p->source_file : "");
+  fprintf(f, "%-10s %6s %10s %10s %8s %8s %8s %8s  %s\n", "pc", "line",
+          "execs", "stalls", "l1i_miss", "l1d_miss", "l2_miss", "row_conf",
+          "source");
+  for (uint32_t k = 0; k < n; ++k) {
+    uint32_t i = order[k];
+    Profile_Entry *e = p->entries + i;
+    char line[16] = "-";
+    const char *text = "";
+
+    if (i < p->num_source_lines) {
+      snprintf(line, sizeof(line), "%d", p->source_lines[i]);
+      text = p->source_text[i];
+    }
+    fprintf(f, "0x%08x %6s %10llu %10llu %8llu %8llu %8llu %8llu  %s\n",
+            p->text_start + 4 * i, line, (unsigned long long)e->executions,
+            (unsigned long long)e->stall_cycles,
+            (unsigned long long)e->icache_misses,
+            (unsigned long long)e->dcache_misses,
+            (unsigned long long)e->l2_misses,
+            (unsigned long long)e->row_conflicts, text);
+  }
+  fprintf(f, "%-10s %6s %10llu %10llu %8llu %8llu %8llu %8llu\n", "total", "",
+          (unsigned long long)total.executions,
+          (unsigned long long)total.stall_cycles,
+          (unsigned long long)total.icache_misses,
+          (unsigned long long)total.dcache_misses,
+          (unsigned long long)total.l2_misses,
+          (unsigned long long)total.row_conflicts);
+
+  free(order);
+  return fclose(f) == 0;
+}
+
+void profile_free(Profile *p) {
+  profile_free_source(p);
+  free(p->entries);
+  memset(p, 0, sizeof(Profile));
+}
@@ -0,0 +1,66 @@
+/*
+ * Hot-instruction profile
+ *
+ * Counts what each static instruction costs: how often it retired, the L1,
+ * L2 and DRAM events it caused and the stall cycles the CPI stack charged to
+ * it. Entries live in a flat table indexed by (pc - text start) / 4 that
+ * covers the loaded text, so charging an event is an index and an add. PCs
+ * outside the text, and everything while the profile is off (an empty table),
+ * are ignored.
+ *
+ * The report lists the instructions sorted by stall cycles. For a text
+ * program foo.x whose source foo.s sits next to it, each instruction is shown
+ * with its line in foo.s.
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
+
+typedef struct Profile_Entry {
+  uint64_t executions;
+  uint64_t stall_cycles;
+  uint64_t icache_misses, dcache_misses;
+  /* L2 misses (MSHR allocations) and DRAM row conflicts on the way */
+  uint64_t l2_misses, row_conflicts;
+} Profile_Entry;
+
+struct Profile {
+  /* one entry per word of text starting at text_start */
+  Profile_Entry *entries;
+  uint32_t text_start;
+  uint32_t num_entries;
+
+  /* source of the text: file name, and the line number and text of each
+   * instruction in the order the assembler placed them */
+  char *source_file;
+  int *source_lines;
+  char **source_text;
+  uint32_t num_source_lines;
+};
+
+/* start profiling the text in [start, end) */
+void profile_init(Profile *p, uint32_t start, uint32_t end);
+
+/* map the text loaded from program_filename (at text_start) back to the
+ * matching .s file, if there is one */
+void profile_load_source(Profile *p, const char *program_filename);
+
+/* entry of the instruction at pc, NULL if it isn't profiled */
+static inline Profile_Entry *profile_entry(Profile *p, uint32_t pc) {
+  uint32_t idx = (pc - p->text_start) >> 2;
+  return idx < p->num_entries ? p->entries + idx : NULL;
+}
+
+/* write the profiled instructions sorted by stall cycles, false on error */
+bool profile_write(Profile *p, const char *filename);
+
+/* stop profiling and release the table */
+void profile_free(Profile *p);
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "batch.h"
+#include "regress.h"
+#include "shell.h"
+
+#define REGRESS_MAX_LINES 64
+
+/* FNV-1a, only used to tell files apart */
+#define REGRESS_HASH_SEED 0xcbf29ce484222325ULL
+#define REGRESS_HASH_PRIME 0x100000001b3ULL
+
+// The "Name: value" lines of the last rdump in a simulator's output
+typedef struct Regress_Dump {
+  char *text;
+  char *lines[REGRESS_MAX_LINES];
+  int num_lines;
+} Regress_Dump;
+
+typedef struct Regress_Input {
+  char *program;
+  char *command_file;
+
+  /* the reference output, from the cache or from ref_job */
+  uint64_t key;
+  char *reference;
+  bool cached;
+
+  Batch_Job *job;
+  Batch_Job *ref_job;
+
+  bool passed;
+  bool stats_match;
+  uint32_t cycles, retired;
+} Regress_Input;
+
+static uint64_t regress_hash(uint64_t h, const void *p, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    h ^= ((const uint8_t *)p)[i];
+    h *= REGRESS_HASH_PRIME;
+  }
+  return h;
+}
+
+/* a whole file as a string, NULL if it can't be read */
+static char *regress_read_file(const char *filename, size_t *size) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL)
+    return NULL;
+
+  char *data;
+  FILE *out = open_memstream(&data, size);
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    fwrite(buffer, 1, n, out);
+  fclose(out);
+  fclose(f);
+  return data;
+}
+
+static bool regress_hash_file(uint64_t *h, const char *filename) {
+  size_t size;
+  char *data = regress_read_file(filename, &size);
+  if (data == NULL)
+    return false;
+
+  /* the size separates the files hashed one after another */
+  *h = regress_hash(*h, &size, sizeof(size));
+  *h = regress_hash(*h, data, size);
+  free(data);
+  return true;
+}
+
+/* inputs/x/y.x runs the shell commands in inputs/x/y.cmd first, if any */
+static char *regress_command_file(const char *program) {
+  const char *dot = strrchr(program, '.');
+  const char *slash = strrchr(program, '/');
+  size_t base = dot && (slash == NULL || dot > slash) ? (size_t)(dot - program)
+                                                      : strlen(program);
+  struct stat st;
+
+  char *cmd = (char *)malloc(base + sizeof(".cmd"));
+  memcpy(cmd, program, base);
+  strcpy(cmd + base, ".cmd");
+  if (stat(cmd, &st) != 0) {
+    free(cmd);
+    return NULL;
+  }
+  return cmd;
+}
+
+static void regress_print_indented(const char *text) {
+  while (*text) {
+    size_t len = strcspn(text, "\n");
+    printf("    %.*s\n", (int)len, text);
+    text += len + (text[len] == '\n');
+  }
+}
+
+static bool regress_is_register(const char *line) {
+  if (strncmp(line, "PC:", 3) == 0 || strncmp(line, "HI:", 3) == 0 ||
+      strncmp(line, "LO:", 3) == 0)
+    return true;
+  if (line[0] != 'R')
+    return false;
+  line++;
+  while (*line >= '0' && *line <= '9')
+    line++;
+  return *line == ':';
+}
+
+static void regress_parse_dump(Regress_Dump *d, const char *output) {
+  char *save, *line;
+  bool in_dump = false;
+
+  d->text = strdup(output);
+  d->num_lines = 0;
+  for (line = strtok_r(d->text, "\n", &save); line != NULL;
+       line = strtok_r(NULL, "\n", &save)) {
+    /* the shell prompt may precede the output on the same line */
+    if (strncmp(line, "MIPS-SIM> ", 10) == 0)
+      line += 10;
+
+    char *colon = strchr(line, ':');
+    if (colon == NULL || colon == line || colon[1] != ' ' ||
+        strcspn(line, " ") < (size_t)(colon - line))
+      continue;
+
+    /* every rdump starts over at the PC; errors printed before the first
+     * one are not part of a dump */
+    if (strncmp(line, "PC:", 3) == 0) {
+      d->num_lines = 0;
+      in_dump = true;
+    }
+    if (in_dump && d->num_lines < REGRESS_MAX_LINES)
+      d->lines[d->num_lines++] = line;
+  }
+}
+
+static const char *regress_value(Regress_Dump *d, const char *name,
+                                 size_t name_size) {
+  for (int i = 0; i < d->num_lines; ++i) {
+    if (strncmp(d->lines[i], name, name_size) == 0 &&
+        d->lines[i][name_size] == ':')
+      return d->lines[i] + name_size + 2;
+  }
+  return NULL;
+}
+
+// Registers must match; stats only count when both simulators print them
+static void regress_compare(Regress_Input *in, Regress_Dump *ref,
+                            Regress_Dump *dut, bool stats, FILE *report) {
+  const char *cycles = regress_value(dut, "Cycles", 6);
+  const char *retired = regress_value(dut, "RetiredInstr", 12);
+
+  in->passed = ref->num_lines > 0;
+  in->stats_match = true;
+  in->cycles = cycles ? strtoul(cycles, NULL, 0) : 0;
+  in->retired = retired ? strtoul(retired, NULL, 0) : 0;
+
+  if (ref->num_lines == 0)
+    fprintf(report, "    no register dump from the reference\n");
+
+  for (int i = 0; i < ref->num_lines; ++i) {
+    const char *line = ref->lines[i];
+    size_t name_size = strchr(line, ':') - line;
+    const char *expected = line + name_size + 2;
+    const char *actual = regress_value(dut, line, name_size);
+    bool is_register = regress_is_register(line);
+
+    if (actual == NULL && !is_register)
+      continue;
+    if (actual != NULL && strcmp(expected, actual) == 0)
+      continue;
+
+    if (is_register)
+      in->passed = false;
+    else
+      in->stats_match = false;
+    if (is_register || stats)
+      fprintf(report, "    %-14.*s %14s %14s\n", (int)name_size, line,
+              expected, actual ? actual : "-");
+  }
+
+  if (stats && !in->stats_match)
+    in->passed = false;
+}
+
+static void regress_json_string(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+static bool regress_write_summary(const char *filename, Sim_Options *options,
+                                  Regress_Input *inputs, int num_inputs,
+                                  int num_failed, double host_seconds) {
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    printf("Error: can't write regression summary %s\n", filename);
+    return false;
+  }
+
+  fprintf(f, "{\n  \"reference\": ");
+  regress_json_string(f, options->regress_reference);
+  fprintf(f, ",\n  \"passed\": %d,\n  \"failed\": %d,\n",
+          num_inputs - num_failed, num_failed);
+  fprintf(f, "  \"host_seconds\": %.6f,\n  \"inputs\": [\n", host_seconds);
+
+  for (int i = 0; i < num_inputs; ++i) {
+    Regress_Input *in = inputs + i;
+    double seconds = in->job->host_seconds;
+
+    fprintf(f, "    {\"input\": ");
+    regress_json_string(f, in->program);
+    fprintf(f,
+            ", \"passed\": %s, \"stats_match\": %s, \"reference_cached\": %s, "
+            "\"cycles\": %u, \"retired\": %u, \"host_seconds\": %.6f, "
+            "\"kips\": %.1f}%s\n",
+            in->passed ? "true" : "false", in->stats_match ? "true" : "false",
+            in->cached ? "true" : "false", in->cycles, in->retired, seconds,
+            seconds > 0 ? in->retired / seconds / 1e3 : 0.0,
+            i + 1 < num_inputs ? "," : "");
+  }
+
+  fprintf(f, "  ]\n}\n");
+  return fclose(f) == 0;
+}
+
+static double regress_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+bool regress_run(Sim_Options *options) {
+  int num_inputs = options->num_program_files;
+  int num_jobs = 0, num_failed = 0, num_cached = 0;
+  uint64_t ref_hash = REGRESS_HASH_SEED;
+  char path[4096];
+  double start = regress_now();
+
+  if (num_inputs == 0) {
+    printf("Error: no programs to run\n");
+    return false;
+  }
+  if (!regress_hash_file(&ref_hash, options->regress_reference)) {
+    printf("Error: can't read reference simulator %s\n",
+           options->regress_reference);
+    return false;
+  }
+
+  Regress_Input *inputs =
+      (Regress_Input *)calloc(num_inputs, sizeof(Regress_Input));
+  /* one job per program, plus one per reference output not cached yet */
+  Batch_Job *jobs = (Batch_Job *)calloc(2 * num_inputs, sizeof(Batch_Job));
+
+  for (int i = 0; i < num_inputs; ++i) {
+    Regress_Input *in = inputs + i;
+    size_t size;
+
+    in->program = options->program_files[i];
+    in->command_file = regress_command_file(in->program);
+
+    /* a program that can't be read fails as a job of its own */
+    in->key = ref_hash;
+    if (regress_hash_file(&in->key, in->program)) {
+      if (in->command_file)
+        regress_hash_file(&in->key, in->command_file);
+
+      snprintf(path, sizeof(path), "%s/%016llx.out", REGRESS_CACHE_DIR,
+               (unsigned long long)in->key);
+      in->reference = regress_read_file(path, &size);
+      in->cached = in->reference != NULL;
+      num_cached += in->cached;
+    }
+
+    /* the job line names the program and its commands */
+    char *line;
+    FILE *f = open_memstream(&line, &size);
+    if (in->command_file)
+      fprintf(f, "-c %s ", in->command_file);
+    fprintf(f, "%s", in->program);
+    fclose(f);
+
+    in->job = jobs + num_jobs++;
+    batch_parse_job(in->job, line, options);
+    free(line);
+  }
+  batch_run_jobs(jobs, num_jobs, options->batch_threads, NULL, NULL);
+
+  /* then the reference, on the programs the simulator could load: it need
+   * not cope with anything else (the one given with the labs reads an ELF
+   * image as words forever) */
+  int num_ref_jobs = 0;
+  for (int i = 0; i < num_inputs; ++i) {
+    Regress_Input *in = inputs + i;
+    if (in->cached || in->job->failed)
+      continue;
+    in->ref_job = jobs + num_jobs + num_ref_jobs++;
+    batch_parse_job(in->ref_job, in->job->line, options);
+    in->ref_job->external = options->regress_reference;
+  }
+  batch_run_jobs(jobs + num_jobs, num_ref_jobs, options->batch_threads, NULL,
+                 NULL);
+  num_jobs += num_ref_jobs;
+
+  mkdir(REGRESS_CACHE_DIR, 0777);
+  printf("  %-34s%14s%14s%10s\n", "Input", "Cycles", "Retired", "KIPS");
+  for (int i = 0; i < num_inputs; ++i) {
+    Regress_Input *in = inputs + i;
+    Regress_Dump ref, dut;
+
+    /* a failed job only printed why */
+    if (in->job->failed) {
+      printf("  %-4s %-29s%14s%14s%10s\n", "FAIL", in->program, "-", "-", "-");
+      regress_print_indented(in->job->output);
+      num_failed++;
+      continue;
+    }
+
+    if (!in->cached) {
+      in->reference = in->ref_job->output;
+      in->ref_job->output = NULL;
+    }
+
+    regress_parse_dump(&ref, in->reference);
+    regress_parse_dump(&dut, in->job->output);
+
+    /* the mismatches are listed below the input they belong to */
+    char *report;
+    size_t report_size;
+    FILE *f = open_memstream(&report, &report_size);
+    regress_compare(in, &ref, &dut, options->regress_stats, f);
+    fclose(f);
+
+    double seconds = in->job->host_seconds;
+    printf("  %-4s %-29s%14u%14u%10.0f\n", in->passed ? "ok" : "FAIL",
+           in->program, in->cycles, in->retired,
+           seconds > 0 ? in->retired / seconds / 1e3 : 0.0);
+    fwrite(report, 1, report_size, stdout);
+    free(report);
+
+    /* only keep reference outputs that hold a register dump */
+    if (!in->cached && ref.num_lines > 0) {
+      snprintf(path, sizeof(path), "%s/%016llx.out", REGRESS_CACHE_DIR,
+               (unsigned long long)in->key);
+      f = fopen(path, "wb");
+      if (f != NULL) {
+        fputs(in->reference, f);
+        fclose(f);
+      }
+    }
+
+    num_failed += !in->passed;
+    free(ref.text);
+    free(dut.text);
+  }
+
+  double host_seconds = regress_now() - start;
+  printf("\n%d passed, %d failed, %d/%d reference outputs cached, %.2f s\n",
+         num_inputs - num_failed, num_failed, num_cached, num_inputs,
+         host_seconds);
+
+  bool ok = num_failed == 0;
+  if (options->regress_summary &&
+      !regress_write_summary(options->regress_summary, options, inputs,
+                             num_inputs, num_failed, host_seconds))
+    ok = false;
+
+  for (int i = 0; i < num_jobs; ++i)
+    batch_free_job(jobs + i);
+  for (int i = 0; i < num_inputs; ++i) {
+    free(inputs[i].command_file);
+    free(inputs[i].reference);
+  }
+  free(jobs);
+  free(inputs);
+  return ok;
+}
@@ -0,0 +1,18 @@
+#ifndef _REGRESS_H_
+#define _REGRESS_H_
+
+#include <stdbool.h>
+
+#include "shell.h"
+
+/* where reference outputs are kept, keyed by a hash of the reference binary,
+ * the program and its command file */
+#define REGRESS_CACHE_DIR ".regress_cache"
+
+/* Run every program file (with the .cmd file next to it, if any) as a batch
+ * job and compare the final register dump, and with -S the stats, against
+ * the reference simulator. Writes a JSON summary with -o. Returns false if
+ * any program fails. */
+bool regress_run(Sim_Options *options);
+
+#endif
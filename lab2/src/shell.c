@@ -11,53 +11,80 @@
 /* !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! */
 
 #include <assert.h>
+#include <elf.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "batch.h"
+#include "checkpoint.h"
+#include "functional.h"
+#include "host_profile.h"
+#include "konata.h"
 #include "pipe.h"
+#include "profile.h"
+#include "regress.h"
 #include "shell.h"
-
-/***************************************************************/
-/* Statistics.                                                 */
-/***************************************************************/
-
-uint32_t stat_cycles = 0, stat_inst_retire = 0, stat_inst_fetch = 0;
-uint32_t stat_squash = 0;
-uint32_t stat_inst_cache_hits = 0, stat_inst_cache_misses = 0;
-uint32_t stat_data_cache_hits = 0, stat_data_cache_misses = 0;
+#include "sim.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
 
 /***************************************************************/
 /* Main memory.                                                */
 /***************************************************************/
 
+/* conventional MIPS layout; memory itself covers the whole address space */
 #define MEM_DATA_START 0x10000000
-#define MEM_DATA_SIZE 0x00100000
 #define MEM_TEXT_START 0x00400000
-#define MEM_TEXT_SIZE 0x00100000
 #define MEM_STACK_START 0x7ff00000
-#define MEM_STACK_SIZE 0x00100000
 #define MEM_KDATA_START 0x90000000
-#define MEM_KDATA_SIZE 0x00100000
 #define MEM_KTEXT_START 0x80000000
-#define MEM_KTEXT_SIZE 0x00100000
 
-typedef struct {
-  uint32_t start, size;
-  uint8_t *mem;
-} mem_region_t;
+/* guest pages are kept in the simulator context (sim.h) */
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {{MEM_TEXT_START, MEM_TEXT_SIZE, NULL},
-                              {MEM_DATA_START, MEM_DATA_SIZE, NULL},
-                              {MEM_STACK_START, MEM_STACK_SIZE, NULL},
-                              {MEM_KDATA_START, MEM_KDATA_SIZE, NULL},
-                              {MEM_KTEXT_START, MEM_KTEXT_SIZE, NULL}};
+/* host pointer for a guest byte, NULL if its page was never written */
+static inline uint8_t *mem_host_addr(uint32_t address) {
+  uint8_t *page = sim->MEM_PAGES[address >> MEM_PAGE_BITS];
+  return page ? page + (address & MEM_PAGE_MASK) : NULL;
+}
 
-#define MEM_NREGIONS (sizeof(MEM_REGIONS) / sizeof(mem_region_t))
+/* host pointer for a guest byte, allocating its page on first touch */
+static inline uint8_t *mem_host_addr_alloc(uint32_t address) {
+  uint8_t **page = sim->MEM_PAGES + (address >> MEM_PAGE_BITS);
+  if (*page == NULL) {
+    *page = calloc(1, MEM_PAGE_SIZE);
+    if (*page == NULL) {
+      printf("Error: out of memory for guest page 0x%08x\n",
+             address & ~MEM_PAGE_MASK);
+      exit(-1);
+    }
+  }
+  return *page + (address & MEM_PAGE_MASK);
+}
+
+/* true if a guest page points into a mapped file */
+static bool mem_page_mapped(uint8_t *page) {
+  for (int m = 0; m < sim->MEM_NUM_MAPPINGS; m++) {
+    Mem_Mapping *map = sim->MEM_MAPPINGS + m;
+    if (page >= map->data && page < map->data + map->size)
+      return true;
+  }
+  return false;
+}
 
-int RUN_BIT = TRUE;
+/* keep a mapping that backs guest pages until memory is released */
+static void mem_add_mapping(uint8_t *data, size_t size) {
+  assert(sim->MEM_NUM_MAPPINGS < MEM_MAX_MAPPINGS);
+  sim->MEM_MAPPINGS[sim->MEM_NUM_MAPPINGS].data = data;
+  sim->MEM_MAPPINGS[sim->MEM_NUM_MAPPINGS].size = size;
+  sim->MEM_NUM_MAPPINGS++;
+}
 
 /***************************************************************/
 /*                                                             */
@@ -67,20 +94,25 @@ int RUN_BIT = TRUE;
 /*                                                             */
 /***************************************************************/
 uint32_t mem_read_32(uint32_t address) {
-  uint32_t i;
-  for (i = 0; i < MEM_NREGIONS; i++) {
-    if (address >= MEM_REGIONS[i].start &&
-        address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-      uint32_t offset = address - MEM_REGIONS[i].start;
-
-      return (MEM_REGIONS[i].mem[offset + 3] << 24) |
-             (MEM_REGIONS[i].mem[offset + 2] << 16) |
-             (MEM_REGIONS[i].mem[offset + 1] << 8) |
-             (MEM_REGIONS[i].mem[offset + 0] << 0);
-    }
+  uint8_t *p;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  /* an aligned word never crosses a page: one host load */
+  if ((address & 3) == 0) {
+    uint32_t value;
+    if ((p = mem_host_addr(address)) == NULL)
+      return 0;
+    memcpy(&value, p, sizeof(value));
+    return value;
   }
+#endif
 
-  return 0;
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--) {
+    p = mem_host_addr(address + i);
+    value = (value << 8) | (p ? *p : 0);
+  }
+  return value;
 }
 
 /***************************************************************/
@@ -91,19 +123,21 @@ uint32_t mem_read_32(uint32_t address) {
 /*                                                             */
 /***************************************************************/
 void mem_write_32(uint32_t address, uint32_t value) {
-  uint32_t i;
-  for (i = 0; i < MEM_NREGIONS; i++) {
-    if (address >= MEM_REGIONS[i].start &&
-        address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-      uint32_t offset = address - MEM_REGIONS[i].start;
-
-      MEM_REGIONS[i].mem[offset + 3] = (value >> 24) & 0xFF;
-      MEM_REGIONS[i].mem[offset + 2] = (value >> 16) & 0xFF;
-      MEM_REGIONS[i].mem[offset + 1] = (value >> 8) & 0xFF;
-      MEM_REGIONS[i].mem[offset + 0] = (value >> 0) & 0xFF;
-      return;
-    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if ((address & 3) == 0) {
+    memcpy(mem_host_addr_alloc(address), &value, sizeof(value));
+
+    /* the word may hold an instruction that is cached decoded */
+    pipe_decode_cache_invalidate(address);
+    return;
   }
+#endif
+
+  for (int i = 0; i < 4; i++)
+    *mem_host_addr_alloc(address + i) = (value >> (8 * i)) & 0xFF;
+
+  pipe_decode_cache_invalidate(address & ~3);
+  pipe_decode_cache_invalidate((address + 3) & ~3);
 }
 
 /***************************************************************/
@@ -114,14 +148,21 @@ void mem_write_32(uint32_t address, uint32_t value) {
 /*                                                             */
 /***************************************************************/
 void help() {
-  printf("----------------MIPS ISIM Help-----------------------\n");
-  printf("go                     -  run program to completion         \n");
-  printf("run n                  -  execute program for n instructions\n");
-  printf("rdump                  -  dump architectural registers      \n");
-  printf("mdump low high         -  dump memory from low to high      \n");
-  printf("input reg_no reg_value - set GPR reg_no to reg_value  \n");
-  printf("?                      -  display this help menu            \n");
-  printf("quit                   -  exit the program                  \n\n");
+  FILE *out = sim->out;
+  fprintf(out, "----------------MIPS ISIM Help-----------------------\n");
+  fprintf(out, "go                     -  run program to completion         \n");
+  fprintf(out, "run n                  -  execute program for n instructions\n");
+  fprintf(out, "rdump                  -  dump architectural registers      \n");
+  fprintf(out, "mdump low high         -  dump memory from low to high      \n");
+  fprintf(out, "cpi                    -  print the CPI stack               \n");
+  fprintf(out, "input reg_no reg_value - set GPR reg_no to reg_value  \n");
+  fprintf(out, "fastfwd n [pc]         -  execute n instructions (or up to pc)\n");
+  fprintf(out, "                          functionally, without timing      \n");
+  fprintf(out, "warmfwd n [pc]         -  fastfwd, filling the L1/L2 tags   \n");
+  fprintf(out, "checkpoint file        -  save the simulator state to file  \n");
+  fprintf(out, "restore file           -  load the simulator state from file\n");
+  fprintf(out, "?                      -  display this help menu            \n");
+  fprintf(out, "quit                   -  exit the program                  \n\n");
 }
 
 /***************************************************************/
@@ -134,7 +175,29 @@ void help() {
 void cycle() {
   pipe_cycle();
 
-  stat_cycles++;
+  sim->stat_cycles++;
+  stats_tick(&sim->stats, sim->stat_cycles);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : skip_idle                                       */
+/*                                                             */
+/* Purpose   : Skip up to max_cycles cycles in which nothing   */
+/*             can change, returns the number of skipped ones  */
+/*                                                             */
+/***************************************************************/
+int skip_idle(int max_cycles) {
+  /* stop at the next stats snapshot */
+  if (sim->stats.interval &&
+      sim->stats.next_snapshot - sim->stat_cycles < (uint64_t)max_cycles)
+    max_cycles = sim->stats.next_snapshot - sim->stat_cycles;
+
+  int skipped = pipe_skip_idle_cycles(max_cycles);
+
+  sim->stat_cycles += skipped;
+  stats_tick(&sim->stats, sim->stat_cycles);
+  return skipped;
 }
 
 /***************************************************************/
@@ -147,17 +210,22 @@ void cycle() {
 void run(int num_cycles) {
   int i;
 
-  if (RUN_BIT == FALSE) {
-    printf("Can't simulate, Simulator is halted\n\n");
+  if (sim->RUN_BIT == FALSE) {
+    fprintf(sim->out, "Can't simulate, Simulator is halted\n\n");
     return;
   }
 
-  printf("Simulating for %d cycles...\n\n", num_cycles);
+  fprintf(sim->out, "Simulating for %d cycles...\n\n", num_cycles);
   for (i = 0; i < num_cycles; i++) {
-    if (RUN_BIT == FALSE) {
-      printf("Simulator halted\n\n");
+    if (sim->RUN_BIT == FALSE) {
+      fprintf(sim->out, "Simulator halted\n\n");
       break;
     }
+    if (sim->SKIP_IDLE_BIT) {
+      i += skip_idle(num_cycles - i);
+      if (i == num_cycles)
+        break;
+    }
     cycle();
   }
 }
@@ -170,15 +238,46 @@ void run(int num_cycles) {
 /*                                                             */
 /***************************************************************/
 void go() {
-  if (RUN_BIT == FALSE) {
-    printf("Can't simulate, Simulator is halted\n\n");
+  if (sim->RUN_BIT == FALSE) {
+    fprintf(sim->out, "Can't simulate, Simulator is halted\n\n");
     return;
   }
 
-  printf("Simulating...\n\n");
-  while (RUN_BIT)
+  fprintf(sim->out, "Simulating...\n\n");
+  while (sim->RUN_BIT) {
+    if (sim->SKIP_IDLE_BIT)
+      skip_idle(INT_MAX);
     cycle();
-  printf("Simulator halted\n\n");
+  }
+  fprintf(sim->out, "Simulator halted\n\n");
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fast_forward                                    */
+/*                                                             */
+/* Purpose   : Execute up to num_insts instructions (or up to  */
+/*             stop_pc) without timing, then hand back to the  */
+/*             pipeline                                        */
+/*                                                             */
+/***************************************************************/
+void fast_forward(uint32_t num_insts, bool stop_at_pc, uint32_t stop_pc,
+                  bool warm) {
+  uint32_t executed;
+
+  if (sim->RUN_BIT == FALSE) {
+    fprintf(sim->out, "Can't simulate, Simulator is halted\n\n");
+    return;
+  }
+
+  fprintf(sim->out, "Fast-forwarding%s...\n\n",
+          warm ? " (warming caches)" : "");
+  executed = functional_run(num_insts, stop_at_pc, stop_pc, warm);
+  fprintf(sim->out, "Fast-forwarded %u instructions to PC 0x%08x\n\n", executed,
+         sim->pipe.PC);
+
+  if (sim->RUN_BIT == FALSE)
+    fprintf(sim->out, "Simulator halted\n\n");
 }
 
 /***************************************************************/
@@ -189,26 +288,31 @@ void go() {
 /*                                                             */
 /***************************************************************/
 void rdump() {
+  FILE *out = sim->out;
   int i;
 
-  printf("PC: 0x%08x\n", pipe.PC);
+  fprintf(out, "PC: 0x%08x\n", sim->pipe.PC);
 
   for (i = 0; i < 32; i++) {
-    printf("R%d: 0x%08x\n", i, pipe.REGS[i]);
+    fprintf(out, "R%d: 0x%08x\n", i, sim->pipe.REGS[i]);
   }
 
-  printf("HI: 0x%08x\n", pipe.HI);
-  printf("LO: 0x%08x\n", pipe.LO);
-  printf("Cycles: %u\n", stat_cycles);
-  printf("FetchedInstr: %u\n", stat_inst_fetch);
-  printf("RetiredInstr: %u\n", stat_inst_retire);
-  printf("IPC: %0.3f\n", ((float)stat_inst_retire) / stat_cycles);
-  printf("Flushes: %u\n", stat_squash);
+  fprintf(out, "HI: 0x%08x\n", sim->pipe.HI);
+  fprintf(out, "LO: 0x%08x\n", sim->pipe.LO);
+  fprintf(out, "Cycles: %u\n", sim->stat_cycles);
+  fprintf(out, "FetchedInstr: %u\n", sim->stat_inst_fetch);
+  fprintf(out, "RetiredInstr: %u\n", sim->stat_inst_retire);
+  fprintf(out, "IPC: %0.3f\n",
+          ((float)sim->stat_inst_retire) / sim->stat_cycles);
+  fprintf(out, "Flushes: %u\n", sim->stat_squash);
+  fprintf(out, "FastForwarded: %u\n", sim->stat_inst_ffwd);
   /* every miss is also counted as a hit */
-  printf("InstHit: %u\n", stat_inst_cache_hits - stat_inst_cache_misses); 
-  printf("InstMiss: %u\n", stat_inst_cache_misses); 
-  printf("DataHit: %u\n", stat_data_cache_hits - stat_data_cache_misses); 
-  printf("DataMiss: %u\n", stat_data_cache_misses); 
+  fprintf(out, "InstHit: %u\n",
+          sim->stat_inst_cache_hits - sim->stat_inst_cache_misses);
+  fprintf(out, "InstMiss: %u\n", sim->stat_inst_cache_misses); 
+  fprintf(out, "DataHit: %u\n",
+          sim->stat_data_cache_hits - sim->stat_data_cache_misses);
+  fprintf(out, "DataMiss: %u\n", sim->stat_data_cache_misses); 
 }
 
 /***************************************************************/
@@ -220,33 +324,38 @@ void rdump() {
 /*                                                             */
 /***************************************************************/
 void mdump(int start, int stop) {
+  FILE *out = sim->out;
   int address;
 
-  printf("\nMemory content [0x%08x..0x%08x] :\n", start, stop);
-  printf("-------------------------------------\n");
+  fprintf(out, "\nMemory content [0x%08x..0x%08x] :\n", start, stop);
+  fprintf(out, "-------------------------------------\n");
   for (address = start; address <= stop; address += 4)
-    printf("  0x%08x (%d) : 0x%08x\n", address, address, mem_read_32(address));
-  printf("\n");
+    fprintf(out, "  0x%08x (%d) : 0x%08x\n", address, address,
+            mem_read_32(address));
+  fprintf(out, "\n");
 }
 
 /***************************************************************/
 /*                                                             */
 /* Procedure : get_command                                     */
 /*                                                             */
-/* Purpose   : Read a command from standard input.             */
+/* Purpose   : Read a command from in and run it, false at    */
+/*             the end of the input or on quit                 */
 /*                                                             */
 /***************************************************************/
-void get_command() {
-  char buffer[20];
+bool get_command(FILE *in) {
+  char buffer[20], line[80], filename[256];
   int start, stop, cycles;
   int register_no, register_value;
+  uint32_t num_insts, stop_pc;
+  int num_args;
 
-  printf("MIPS-SIM> ");
+  fprintf(sim->out, "MIPS-SIM> ");
 
-  if (scanf("%s", buffer) == EOF)
-    exit(0);
+  if (fscanf(in, "%19s", buffer) != 1)
+    return false;
 
-  printf("\n");
+  fprintf(sim->out, "\n");
 
   switch (buffer[0]) {
   case 'G':
@@ -256,7 +365,7 @@ void get_command() {
 
   case 'M':
   case 'm':
-    if (scanf("%i %i", &start, &stop) != 2)
+    if (fscanf(in, "%i %i", &start, &stop) != 2)
       break;
 
     mdump(start, stop);
@@ -265,17 +374,51 @@ void get_command() {
   case '?':
     help();
     break;
+
+  case 'F':
+  case 'f':
+  case 'W':
+  case 'w':
+    /* the stop pc is optional */
+    if (fgets(line, sizeof(line), in) == NULL)
+      break;
+    num_args = sscanf(line, "%u %x", &num_insts, &stop_pc);
+    if (num_args < 1)
+      break;
+
+    fast_forward(num_insts, num_args == 2, stop_pc,
+                 buffer[0] == 'w' || buffer[0] == 'W');
+    break;
   case 'Q':
   case 'q':
-    printf("Bye.\n");
-    exit(0);
+    fprintf(sim->out, "Bye.\n");
+    return false;
+
+  case 'C':
+  case 'c':
+    if (buffer[1] == 'p' || buffer[1] == 'P') {
+      pipe_cpi_report(sim->out);
+      break;
+    }
+    if (fscanf(in, "%255s", filename) != 1)
+      break;
+
+    if (checkpoint_save(filename))
+      fprintf(sim->out, "Saved checkpoint to %s\n\n", filename);
+    break;
 
   case 'R':
   case 'r':
     if (buffer[1] == 'd' || buffer[1] == 'D')
       rdump();
-    else {
-      if (scanf("%d", &cycles) != 1)
+    else if (buffer[1] == 'e' || buffer[1] == 'E') {
+      if (fscanf(in, "%255s", filename) != 1)
+        break;
+
+      if (checkpoint_restore(filename))
+        fprintf(sim->out, "Restored checkpoint from %s\n\n", filename);
+    } else {
+      if (fscanf(in, "%d", &cycles) != 1)
         break;
       run(cycles);
     }
@@ -283,48 +426,257 @@ void get_command() {
 
   case 'I':
   case 'i':
-    if (scanf("%i %i", &register_no, &register_value) != 2)
+    if (fscanf(in, "%i %i", &register_no, &register_value) != 2)
       break;
 
-    printf("%i %i\n", register_no, register_value);
-    pipe.REGS[register_no] = register_value;
+    fprintf(sim->out, "%i %i\n", register_no, register_value);
+    sim->pipe.REGS[register_no] = register_value;
     break;
 
   case 'H':
   case 'h':
-    if (scanf("%i", &register_value) != 1)
+    if (fscanf(in, "%i", &register_value) != 1)
       break;
 
-    pipe.HI = register_value;
+    sim->pipe.HI = register_value;
     break;
 
   case 'L':
   case 'l':
-    if (scanf("%i", &register_value) != 1)
+    if (fscanf(in, "%i", &register_value) != 1)
       break;
 
-    pipe.LO = register_value;
+    sim->pipe.LO = register_value;
     break;
 
   default:
-    printf("Invalid Command\n");
+    fprintf(sim->out, "Invalid Command\n");
     break;
   }
+  return true;
 }
 
 /***************************************************************/
 /*                                                             */
 /* Procedure : init_memory                                     */
 /*                                                             */
-/* Purpose   : Allocate and zero memoryy                       */
+/* Purpose   : Release all guest pages, memory reads as zero    */
 /*                                                             */
 /***************************************************************/
 void init_memory() {
   uint32_t i;
-  for (i = 0; i < MEM_NREGIONS; i++) {
-    MEM_REGIONS[i].mem = malloc(MEM_REGIONS[i].size);
-    memset(MEM_REGIONS[i].mem, 0, MEM_REGIONS[i].size);
+  int m;
+
+  for (i = 0; i < MEM_NPAGES; i++) {
+    if (!mem_page_mapped(sim->MEM_PAGES[i]))
+      free(sim->MEM_PAGES[i]);
+    sim->MEM_PAGES[i] = NULL;
+  }
+
+  for (m = 0; m < sim->MEM_NUM_MAPPINGS; m++)
+    munmap(sim->MEM_MAPPINGS[m].data, sim->MEM_MAPPINGS[m].size);
+  sim->MEM_NUM_MAPPINGS = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : mem_save                                        */
+/*                                                             */
+/* Purpose   : Write all touched guest pages to a checkpoint   */
+/*                                                             */
+/***************************************************************/
+void mem_save(Checkpoint *ck) {
+  uint32_t i, num_pages = 0;
+
+  for (i = 0; i < MEM_NPAGES; i++)
+    num_pages += sim->MEM_PAGES[i] != NULL;
+  checkpoint_write_value(ck, num_pages);
+
+  /* page data is aligned in the file so it can be used in place */
+  for (i = 0; i < MEM_NPAGES; i++) {
+    if (sim->MEM_PAGES[i] == NULL)
+      continue;
+    checkpoint_write_value(ck, i);
+    checkpoint_align(ck, MEM_PAGE_SIZE);
+    checkpoint_write(ck, sim->MEM_PAGES[i], MEM_PAGE_SIZE);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : mem_restore                                     */
+/*                                                             */
+/* Purpose   : Point the guest pages into a mapped checkpoint  */
+/*                                                             */
+/***************************************************************/
+void mem_restore(Checkpoint *ck) {
+  uint32_t i, page, num_pages;
+
+  init_memory();
+  mem_add_mapping(ck->data, ck->size);
+
+  checkpoint_read_value(ck, num_pages);
+  for (i = 0; i < num_pages; i++) {
+    checkpoint_read_value(ck, page);
+    /* each page is written once, and init_memory left all of them empty */
+    if (page >= MEM_NPAGES || sim->MEM_PAGES[page] != NULL) {
+      printf("Error: checkpoint is corrupt\n");
+      exit(-1);
+    }
+    checkpoint_align(ck, MEM_PAGE_SIZE);
+    sim->MEM_PAGES[page] = checkpoint_read_mapped(ck, MEM_PAGE_SIZE);
+  }
+
+  /* the text may have changed under the decoded ops */
+  pipe_decode_cache_flush();
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : add_text                                       */
+/*                                                            */
+/* Purpose   : Grow the extent of the loaded text to cover    */
+/*             [start, end), for the profile                  */
+/*                                                            */
+/**************************************************************/
+static void add_text(uint32_t start, uint32_t end) {
+  if (sim->text_start == sim->text_end) {
+    sim->text_start = start;
+    sim->text_end = end;
+    return;
+  }
+  if (start < sim->text_start)
+    sim->text_start = start;
+  if (end > sim->text_end)
+    sim->text_end = end;
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : load_elf_segment                               */
+/*                                                            */
+/* Purpose   : Place a loadable segment of a mapped ELF image */
+/*             into guest memory, true if any page uses the   */
+/*             image in place                                 */
+/*                                                            */
+/**************************************************************/
+static bool load_elf_segment(uint8_t *image, size_t size, Elf32_Phdr *ph,
+                             bool can_map) {
+  uint64_t start = ph->p_vaddr, end = start + ph->p_memsz;
+  uint64_t file_end = start + ph->p_filesz;
+  uint64_t page, from, to;
+  bool mapped = false;
+
+  for (page = start & ~(uint64_t)MEM_PAGE_MASK; page < end;
+       page += MEM_PAGE_SIZE) {
+    uint8_t **p = sim->MEM_PAGES + (page >> MEM_PAGE_BITS);
+    int64_t offset = (int64_t)ph->p_offset - (int64_t)(start - page);
+
+    /* a page that lies entirely inside the file is used in place; its bytes
+     * outside the segment are whatever the file holds there, as with any
+     * loader that maps segments */
+    if (*p == NULL && can_map && offset >= 0 &&
+        (uint64_t)offset + MEM_PAGE_SIZE <= size) {
+      *p = image + offset;
+      mapped = true;
+    } else {
+      from = page > start ? page : start;
+      to = page + MEM_PAGE_SIZE < file_end ? page + MEM_PAGE_SIZE : file_end;
+      if (from < to)
+        memcpy(mem_host_addr_alloc(from), image + ph->p_offset + (from - start),
+               to - from);
+    }
+
+    /* the rest of the segment is zero (.bss) */
+    from = page > file_end ? page : file_end;
+    to = page + MEM_PAGE_SIZE < end ? page + MEM_PAGE_SIZE : end;
+    if (from < to)
+      memset(mem_host_addr_alloc(from), 0, to - from);
   }
+
+  return mapped;
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : load_elf                                       */
+/*                                                            */
+/* Purpose   : Map a little-endian MIPS ELF32 executable into */
+/*             guest memory and start at its entry point      */
+/*                                                            */
+/**************************************************************/
+bool load_elf(char *program_filename, FILE *prog) {
+  struct stat st;
+  Elf32_Ehdr *eh;
+  int i, num_segments = 0;
+  bool mapped = false;
+  bool can_map = sim->MEM_NUM_MAPPINGS < MEM_MAX_MAPPINGS;
+
+  if (fstat(fileno(prog), &st) != 0 || (size_t)st.st_size < sizeof(*eh)) {
+    fprintf(sim->out, "Error: %s is not an ELF executable\n",
+            program_filename);
+    fclose(prog);
+    return false;
+  }
+
+  /* private mapping: pages used in place are copied once they get written */
+  size_t size = st.st_size;
+  uint8_t *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                        fileno(prog), 0);
+  fclose(prog);
+  if (image == MAP_FAILED) {
+    fprintf(sim->out, "Error: Can't map program file %s\n", program_filename);
+    return false;
+  }
+
+  eh = (Elf32_Ehdr *)image;
+  if (eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+      eh->e_ident[EI_DATA] != ELFDATA2LSB || eh->e_machine != EM_MIPS ||
+      eh->e_phentsize != sizeof(Elf32_Phdr) ||
+      (uint64_t)eh->e_phoff + eh->e_phnum * sizeof(Elf32_Phdr) > size) {
+    fprintf(sim->out,
+            "Error: %s is not a little-endian MIPS ELF32 executable\n",
+            program_filename);
+    munmap(image, size);
+    return false;
+  }
+
+  /* check every segment first: pages placed so far would point into the
+   * image once it is unmapped */
+  Elf32_Phdr *ph = (Elf32_Phdr *)(image + eh->e_phoff);
+  for (i = 0; i < eh->e_phnum; i++) {
+    if (ph[i].p_type == PT_LOAD &&
+        (ph[i].p_filesz > ph[i].p_memsz ||
+         (uint64_t)ph[i].p_vaddr + ph[i].p_memsz > (1ULL << 32) ||
+         (uint64_t)ph[i].p_offset + ph[i].p_filesz > size)) {
+      fprintf(sim->out, "Error: bad segment %d in %s\n", i, program_filename);
+      munmap(image, size);
+      return false;
+    }
+  }
+
+  for (i = 0; i < eh->e_phnum; i++) {
+    if (ph[i].p_type != PT_LOAD)
+      continue;
+    if (load_elf_segment(image, size, ph + i, can_map))
+      mapped = true;
+    if (ph[i].p_flags & PF_X)
+      add_text(ph[i].p_vaddr, ph[i].p_vaddr + ph[i].p_memsz);
+    num_segments++;
+  }
+
+  sim->pipe.PC = eh->e_entry;
+  if (mapped)
+    mem_add_mapping(image, size);
+  else
+    munmap(image, size);
+
+  /* the text was placed without mem_write_32 */
+  pipe_decode_cache_flush();
+
+  fprintf(sim->out, "Loaded %d segments from program, entry 0x%08x.\n\n",
+          num_segments, sim->pipe.PC);
+  return true;
 }
 
 /**************************************************************/
@@ -334,16 +686,24 @@ void init_memory() {
 /* Purpose   : Load program and service routines into mem.    */
 /*                                                            */
 /**************************************************************/
-void load_program(char *program_filename) {
+bool load_program(char *program_filename) {
   FILE *prog;
   int ii, word;
+  char magic[SELFMAG];
 
   /* Open program file. */
   prog = fopen(program_filename, "r");
   if (prog == NULL) {
-    printf("Error: Can't open program file %s\n", program_filename);
-    exit(-1);
+    fprintf(sim->out, "Error: Can't open program file %s\n", program_filename);
+    return false;
+  }
+
+  /* binary images are mapped, everything else is text with a word a line */
+  if (fread(magic, 1, SELFMAG, prog) == SELFMAG &&
+      memcmp(magic, ELFMAG, SELFMAG) == 0) {
+    return load_elf(program_filename, prog);
   }
+  rewind(prog);
 
   /* Read in the program. */
 
@@ -352,8 +712,11 @@ void load_program(char *program_filename) {
     mem_write_32(MEM_TEXT_START + ii, word);
     ii += 4;
   }
+  fclose(prog);
+  add_text(MEM_TEXT_START, MEM_TEXT_START + ii);
 
-  printf("Read %d words from program into memory.\n\n", ii / 4);
+  fprintf(sim->out, "Read %d words from program into memory.\n\n", ii / 4);
+  return true;
 }
 
 /************************************************************/
@@ -364,18 +727,258 @@ void load_program(char *program_filename) {
 /*             and set up initial state of the machine.     */
 /*                                                          */
 /************************************************************/
-void initialize(char *program_filename, int num_prog_files) {
+bool initialize(char **program_filenames, int num_prog_files) {
   int i;
 
   init_memory();
   pipe_init();
-  for (i = 0; i < num_prog_files; i++) {
-    load_program(program_filename);
-    while (*program_filename++ != '\0')
-      ;
+  sim->text_start = sim->text_end = 0;
+  for (i = 0; i < num_prog_files; i++)
+    if (!load_program(program_filenames[i]))
+      return false;
+
+  sim->RUN_BIT = TRUE;
+  return true;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : parse_options                                   */
+/*                                                             */
+/* Purpose   : Parse [options] <program files> on top of the   */
+/*             options already in o                            */
+/*                                                             */
+/***************************************************************/
+bool parse_options(int argc, char **argv, Sim_Options *o) {
+  int argi = 0;
+
+  /* Options come before the program files */
+  while (argi < argc && argv[argi][0] == '-') {
+    if (strcmp(argv[argi], "-f") == 0) {
+      o->skip_idle = true;
+    } else if (strcmp(argv[argi], "-m") == 0 && argi + 1 < argc) {
+      o->l2_mshrs = atoi(argv[++argi]);
+      if (o->l2_mshrs <= 0) {
+        printf("Error: bad number of L2 MSHRs %s\n", argv[argi]);
+        return false;
+      }
+    } else if (strcmp(argv[argi], "-M") == 0 && argi + 1 < argc) {
+      o->l2_mshr_targets = atoi(argv[++argi]);
+      if (o->l2_mshr_targets <= 0) {
+        printf("Error: bad number of L2 MSHR targets %s\n", argv[argi]);
+        return false;
+      }
+    } else if (strcmp(argv[argi], "-N") == 0 && argi + 1 < argc) {
+      o->dcache_miss_queue = atoi(argv[++argi]);
+      if (o->dcache_miss_queue <= 0 ||
+          o->dcache_miss_queue > PIPE_MISS_QUEUE_SIZE) {
+        printf("Error: bad number of D$ miss queue entries %s\n", argv[argi]);
+        return false;
+      }
+    } else if (strcmp(argv[argi], "-F") == 0 && argi + 1 < argc) {
+      o->ffwd = true;
+      o->ffwd_insts = strtoul(argv[++argi], NULL, 0);
+    } else if (strcmp(argv[argi], "-P") == 0 && argi + 1 < argc) {
+      o->ffwd = o->ffwd_stop_at_pc = true;
+      o->ffwd_pc = strtoul(argv[++argi], NULL, 0);
+    } else if (strcmp(argv[argi], "-W") == 0) {
+      o->ffwd_warm = true;
+    } else if (strcmp(argv[argi], "-R") == 0 && argi + 1 < argc) {
+      o->restore_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-C") == 0 && argi + 1 < argc) {
+      o->checkpoint_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-c") == 0 && argi + 1 < argc) {
+      o->command_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-b") == 0 && argi + 1 < argc) {
+      o->batch_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+      o->batch_threads = atoi(argv[++argi]);
+    } else if (strcmp(argv[argi], "-r") == 0 && argi + 1 < argc) {
+      o->regress_reference = argv[++argi];
+    } else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+      o->regress_summary = argv[++argi];
+    } else if (strcmp(argv[argi], "-S") == 0) {
+      o->regress_stats = true;
+    } else if (strcmp(argv[argi], "-s") == 0 && argi + 1 < argc) {
+      o->stats_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-i") == 0 && argi + 1 < argc) {
+      o->stats_interval = strtoul(argv[++argi], NULL, 0);
+    } else if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+      o->trace_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-T") == 0 && argi + 1 < argc) {
+      argi++;
+      if (!trace_parse_components(argv[argi], &o->trace_components)) {
+        printf("Error: bad trace components %s\n", argv[argi]);
+        return false;
+      }
+    } else if (strcmp(argv[argi], "-J") == 0 && argi + 1 < argc) {
+      o->timeline_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-x") == 0 && argi + 1 < argc) {
+      o->host_profile_interval = strtoul(argv[++argi], NULL, 0);
+    } else if (strcmp(argv[argi], "-K") == 0 && argi + 1 < argc) {
+      o->konata_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-H") == 0 && argi + 1 < argc) {
+      o->profile_file = argv[++argi];
+    } else if (strcmp(argv[argi], "-p") == 0 && argi + 1 < argc) {
+      Pc_Range *range = o->pc_ranges + o->num_pc_ranges;
+      char *end;
+      argi++;
+      if (o->num_pc_ranges == MAX_PC_RANGES) {
+        printf("Error: more than %d PC ranges\n", MAX_PC_RANGES);
+        return false;
+      }
+      range->start = strtoul(argv[argi], &end, 0);
+      if (*end != '-') {
+        printf("Error: bad PC range %s\n", argv[argi]);
+        return false;
+      }
+      range->end = strtoul(end + 1, NULL, 0);
+      o->num_pc_ranges++;
+    } else {
+      printf("Error: unknown option %s\n", argv[argi]);
+      return false;
+    }
+    argi++;
+  }
+
+  o->program_files = argv + argi;
+  o->num_program_files = argc - argi;
+  return true;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : start_simulation                                */
+/*                                                             */
+/* Purpose   : Load the programs and apply the options, false  */
+/*             if a program can't be loaded or a checkpoint    */
+/*             can't be restored or saved                      */
+/*                                                             */
+/***************************************************************/
+bool start_simulation(Sim_Options *o) {
+  sim->SKIP_IDLE_BIT = o->skip_idle;
+  if (o->l2_mshrs)
+    sim->l2_mshrs = o->l2_mshrs;
+  if (o->l2_mshr_targets)
+    sim->l2_mshr_targets = o->l2_mshr_targets;
+  if (o->dcache_miss_queue)
+    sim->dcache_miss_queue = o->dcache_miss_queue;
+  memcpy(sim->pc_ranges, o->pc_ranges, sizeof(sim->pc_ranges));
+  sim->num_pc_ranges = o->num_pc_ranges;
+
+  if (!initialize(o->program_files, o->num_program_files))
+    return false;
+
+  if (o->stats_file &&
+      !stats_open(&sim->stats, o->stats_file, o->stats_interval)) {
+    fprintf(sim->out, "Error: Can't write stats file %s\n", o->stats_file);
+    return false;
   }
 
-  RUN_BIT = TRUE;
+  if (o->trace_file &&
+      !trace_open(&sim->trace, o->trace_file,
+                  o->trace_components ? o->trace_components
+                                      : (1u << TRACE_NUM_COMPONENTS) - 1,
+                  &sim->stat_cycles)) {
+    fprintf(sim->out, "Error: Can't write trace file %s\n", o->trace_file);
+    return false;
+  }
+
+  if (o->timeline_file && !timeline_open(&sim->timeline, o->timeline_file)) {
+    fprintf(sim->out, "Error: Can't write timeline %s\n", o->timeline_file);
+    return false;
+  }
+
+  if (o->konata_file &&
+      !konata_open(&sim->konata, o->konata_file, sim->pipe.cycle_count)) {
+    fprintf(sim->out, "Error: Can't write pipeline log %s\n", o->konata_file);
+    return false;
+  }
+
+  if (o->host_profile_interval)
+    host_profile_init(&sim->host_profile, &sim->stats,
+                      o->host_profile_interval);
+
+  if (o->profile_file) {
+    profile_init(&sim->profile, sim->text_start, sim->text_end);
+    for (int i = 0; i < o->num_program_files; i++)
+      profile_load_source(&sim->profile, o->program_files[i]);
+    sim->profile_file = o->profile_file;
+  }
+
+  if (o->restore_file && !checkpoint_restore(o->restore_file))
+    return false;
+
+  /* -P alone runs functionally until the marker pc */
+  if (o->ffwd)
+    fast_forward(o->ffwd_stop_at_pc && o->ffwd_insts == 0 ? UINT32_MAX
+                                                          : o->ffwd_insts,
+                 o->ffwd_stop_at_pc, o->ffwd_pc, o->ffwd_warm);
+
+  if (o->checkpoint_file && !checkpoint_save(o->checkpoint_file))
+    return false;
+
+  return true;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : finish_simulation                               */
+/*                                                             */
+/* Purpose   : Write the final stats snapshot, false on error  */
+/*                                                             */
+/***************************************************************/
+bool finish_simulation() {
+  bool ok = true;
+
+  if (sim->host_profile.interval)
+    host_profile_report(&sim->host_profile, sim->out);
+
+  if (sim->profile_file && !profile_write(&sim->profile, sim->profile_file)) {
+    fprintf(sim->out, "Error: Can't write profile %s\n", sim->profile_file);
+    ok = false;
+  }
+
+  if (sim->stats.file && !stats_close(&sim->stats, sim->stat_cycles)) {
+    fprintf(sim->out, "Error: Can't write stats file\n");
+    ok = false;
+  }
+
+  if (sim->trace.file && !trace_close(&sim->trace)) {
+    fprintf(sim->out, "Error: Can't write trace file\n");
+    ok = false;
+  }
+
+  if (!timeline_close(&sim->timeline, sim->pipe.cycle_count)) {
+    fprintf(sim->out, "Error: Can't write timeline\n");
+    ok = false;
+  }
+
+  if (!konata_close(&sim->konata)) {
+    fprintf(sim->out, "Error: Can't write pipeline log\n");
+    ok = false;
+  }
+  return ok;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_command_file                                */
+/*                                                             */
+/* Purpose   : Run all shell commands in a file                */
+/*                                                             */
+/***************************************************************/
+bool run_command_file(const char *filename) {
+  FILE *in = fopen(filename, "r");
+  if (in == NULL) {
+    fprintf(sim->out, "Error: Can't open command file %s\n", filename);
+    return false;
+  }
+
+  while (get_command(in))
+    ;
+  fclose(in);
+  return true;
 }
 
 /***************************************************************/
@@ -383,18 +986,81 @@ void initialize(char *program_filename, int num_prog_files) {
 /* Procedure : main                                            */
 /*                                                             */
 /***************************************************************/
+void usage(char *prog) {
+  printf("Error: usage: %s [options] <program_file_1> <program_file_2> ...\n",
+         prog);
+  printf("       %s [options] -b jobs [-j threads]\n", prog);
+  printf("       %s [options] -r reference [-o summary] [-S] <program files>\n",
+         prog);
+  printf("  -f      fast-forward cycles in which the machine is stalled\n");
+  printf("  -m n    number of L2 MSHRs (default %d)\n", L2_MSHR_SIZE);
+  printf("  -M n    number of requests an L2 MSHR holds (default %d)\n",
+         L2_MSHR_TARGETS);
+  printf("  -N n    non-blocking D$ with n miss queue entries (1-%d)\n",
+         PIPE_MISS_QUEUE_SIZE);
+  printf("  -F n    execute the first n instructions functionally\n");
+  printf("  -P pc   execute functionally up to pc\n");
+  printf("  -W      warm up the L1/L2 caches while executing functionally\n");
+  printf("  -R file restore a checkpoint after loading the program\n");
+  printf("  -C file save a checkpoint once the above is done\n");
+  printf("  -c file run the shell commands in file before reading stdin\n");
+  printf("  -b file run each line of file ([options] <program files>) as a\n");
+  printf("          simulation of its own, followed by go and rdump; only\n");
+  printf("          the output files given on the line are written\n");
+  printf("  -j n    number of batch simulations run at once\n");
+  printf("  -r sim  run each program as a batch job and compare its registers\n");
+  printf("          with the (cached) output of the reference simulator sim\n");
+  printf("  -o file write a JSON summary of the regression to file\n");
+  printf("  -S      also compare the stats printed by both simulators\n");
+  printf("  -s file write all stats to file at the end of the run (JSON, or\n");
+  printf("          CSV if the name ends in .csv)\n");
+  printf("  -i n    also write a snapshot of the stats every n cycles\n");
+  printf("  -p a-b  also break the CPI stack down for the PCs a to b\n");
+  printf("  -H file write a profile of the stalls and misses charged to each\n");
+  printf("          instruction to file at the end of the run\n");
+  printf("  -t file write a binary trace of the memory hierarchy events to\n");
+  printf("          file, render it with trace_decode\n");
+  printf("  -T list trace only these components (l1i,l1d,l1,l2,mem,int)\n");
+  printf("  -J file write a timeline of the pipeline stages, DRAM banks and\n");
+  printf("          buses as Chrome trace-event JSON (for Perfetto)\n");
+  printf("  -K file log the stages of every instruction for the Konata\n");
+  printf("          pipeline viewer\n");
+  printf("  -x n    time the host spends in each component in one of every n\n");
+  printf("          cycles, reported at the end of the run\n");
+  exit(1);
+}
+
+/* tools that link the simulator bring their own main */
+#ifndef SIM_NO_MAIN
 int main(int argc, char *argv[]) {
+  Sim_Options options;
+
+  memset(&options, 0, sizeof(options));
+  if (!parse_options(argc - 1, argv + 1, &options))
+    usage(argv[0]);
+
+  if (options.batch_file)
+    return batch_run(options.batch_file, &options) ? 0 : 1;
+
+  if (options.regress_reference)
+    return regress_run(&options) ? 0 : 1;
 
   /* Error Checking */
-  if (argc < 2) {
-    printf("Error: usage: %s <program_file_1> <program_file_2> ...\n", argv[0]);
-    exit(1);
-  }
+  if (options.num_program_files == 0)
+    usage(argv[0]);
+
+  sim_context_bind(sim_context_create(stdout));
 
   printf("MIPS Simulator\n\n");
 
-  initialize(argv[1], argc - 1);
+  if (!start_simulation(&options))
+    exit(1);
+
+  if (options.command_file && !run_command_file(options.command_file))
+    exit(1);
 
-  while (1)
-    get_command();
+  while (get_command(stdin))
+    ;
+  return finish_simulation() ? 0 : 1;
 }
+#endif
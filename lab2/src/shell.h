@@ -14,18 +14,76 @@
 #ifndef _SIM_SHELL_H_
 #define _SIM_SHELL_H_
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
 
 #define FALSE 0
 #define TRUE 1
 
-extern int RUN_BIT; /* run bit */
-
 /* only the cache touches these functions */
 uint32_t mem_read_32(uint32_t address);
 void mem_write_32(uint32_t address, uint32_t value);
 
-/* statistics */
-extern uint32_t stat_cycles, stat_inst_retire, stat_inst_fetch, stat_squash;
+/* guest memory in checkpoints */
+void mem_save(Checkpoint *ck);
+void mem_restore(Checkpoint *ck);
+
+/* release all guest pages */
+void init_memory();
+
+/* a range of PCs, both ends included */
+#define MAX_PC_RANGES 8
+typedef struct Pc_Range {
+  uint32_t start, end;
+} Pc_Range;
+
+/* how to set up a simulation, from the command line or a batch job */
+typedef struct Sim_Options {
+  bool skip_idle;                        /* -f */
+  int l2_mshrs, l2_mshr_targets;         /* -m, -M, default if 0 */
+  int dcache_miss_queue;                 /* -N, blocking D$ if 0 */
+  bool ffwd, ffwd_stop_at_pc, ffwd_warm; /* -F, -P, -W */
+  uint32_t ffwd_insts, ffwd_pc;
+  char *restore_file;      /* -R */
+  char *checkpoint_file;   /* -C */
+  char *command_file;      /* -c */
+  char *batch_file;        /* -b */
+  int batch_threads;       /* -j, 0 for one per host cpu */
+  char *regress_reference; /* -r */
+  char *regress_summary;   /* -o */
+  bool regress_stats;      /* -S */
+  char *stats_file;        /* -s */
+  uint32_t stats_interval; /* -i */
+  Pc_Range pc_ranges[MAX_PC_RANGES]; /* -p, CPI stacks of their own */
+  int num_pc_ranges;
+  char *profile_file;      /* -H */
+  char *trace_file;        /* -t */
+  uint32_t trace_components; /* -T, all if 0 */
+  char *timeline_file;     /* -J */
+  char *konata_file;       /* -K */
+  uint32_t host_profile_interval; /* -x, off if 0 */
+  char **program_files;
+  int num_program_files;
+} Sim_Options;
+
+/* parse [options] <program files> on top of the options already in o */
+bool parse_options(int argc, char **argv, Sim_Options *o);
+
+/* load the programs into the current context and apply the options; false if
+ * a program can't be loaded or a checkpoint can't be restored or saved */
+bool start_simulation(Sim_Options *o);
+
+/* end of the simulation: write the final stats, false on error */
+bool finish_simulation();
+
+/* shell commands on the current context */
+bool get_command(FILE *in);
+bool run_command_file(const char *filename);
+void cycle();
+void go();
+void rdump();
 
 #endif
@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipe.h"
+#include "shell.h"
+#include "sim.h"
+
+_Thread_local Sim_Context *sim = NULL;
+
+Sim_Context *sim_context_create(FILE *out) {
+  Sim_Context *ctx = (Sim_Context *)calloc(1, sizeof(Sim_Context));
+  if (ctx == NULL) {
+    printf("Error: out of memory for a simulator context\n");
+    exit(-1);
+  }
+
+  ctx->RUN_BIT = TRUE;
+  ctx->SKIP_IDLE_BIT = FALSE;
+  ctx->l2_mshrs = L2_MSHR_SIZE;
+  ctx->l2_mshr_targets = L2_MSHR_TARGETS;
+  ctx->out = out;
+  return ctx;
+}
+
+void sim_context_free(Sim_Context *ctx) {
+  Sim_Context *bound = sim;
+
+  // the release functions work on the bound context
+  sim = ctx;
+  /* the pipeline only exists once the programs were loaded */
+  if (ctx->pipe.decode_cache != NULL)
+    pipe_free();
+  init_memory();
+  stats_free(&ctx->stats);
+  profile_free(&ctx->profile);
+  trace_close(&ctx->trace);
+  timeline_close(&ctx->timeline, ctx->pipe.cycle_count);
+  konata_close(&ctx->konata);
+  sim = bound == ctx ? NULL : bound;
+
+  free(ctx);
+}
+
+void sim_context_bind(Sim_Context *ctx) { sim = ctx; }
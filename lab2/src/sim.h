@@ -0,0 +1,103 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "event_queue.h"
+#include "host_profile.h"
+#include "interconnect.h"
+#include "konata.h"
+#include "l1_cache.h"
+#include "l2_cache.h"
+#include "memory.h"
+#include "pipe.h"
+#include "profile.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
+
+/* Guest memory spans the full 32-bit space as a flat table of 64 KB pages.
+ * A page is allocated (zeroed) on its first write; reads from a page that was
+ * never written return 0 without allocating it. */
+#define MEM_PAGE_BITS 16
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_NPAGES (1 << (32 - MEM_PAGE_BITS))
+
+/* a file mapped into guest memory, e.g. a restored checkpoint or an ELF */
+#define MEM_MAX_MAPPINGS 8
+typedef struct Mem_Mapping {
+  uint8_t *data;
+  size_t size;
+} Mem_Mapping;
+
+// Everything one simulation owns. Several contexts can run at once, each on
+// its own thread; the code works on the context bound to the calling thread
+typedef struct Sim_Context {
+  /* pipeline and the memory hierarchy below it */
+  Pipe_State pipe;
+  L1_Cache_State inst_cache;
+  L1_Cache_State data_cache;
+  L2_Cache_State l2_cache;
+  Memory_State memory;
+  Interconnect_State interconnect;
+  /* the delays in the hierarchy (interconnect, DRAM) end through events */
+  Event_Queue events;
+
+  /* guest memory */
+  uint8_t *MEM_PAGES[MEM_NPAGES];
+  /* mapped files that back some of the pages (those are not malloc'ed) */
+  Mem_Mapping MEM_MAPPINGS[MEM_MAX_MAPPINGS];
+  int MEM_NUM_MAPPINGS;
+
+  /* run bit */
+  int RUN_BIT;
+  /* fast-forward over cycles in which the whole machine is stalled (-f) */
+  int SKIP_IDLE_BIT;
+  /* number of L2 MSHRs (-m) and of targets in each (-M) */
+  int l2_mshrs, l2_mshr_targets;
+  /* entries in the miss queue of the non-blocking D$ (-N), 0 if it blocks */
+  int dcache_miss_queue;
+
+  /* statistics */
+  uint32_t stat_cycles, stat_inst_retire, stat_inst_fetch, stat_squash;
+  uint32_t stat_inst_cache_hits, stat_inst_cache_misses;
+  uint32_t stat_data_cache_hits, stat_data_cache_misses;
+  /* instructions executed by the functional engine (no cycles) */
+  uint32_t stat_inst_ffwd;
+  /* everything the components count, and its dump file */
+  Stats stats;
+  /* PCs that get a CPI stack of their own */
+  Pc_Range pc_ranges[MAX_PC_RANGES];
+  int num_pc_ranges;
+  /* hot-instruction profile (empty unless -H) over the loaded text */
+  Profile profile;
+  char *profile_file;
+  uint32_t text_start, text_end;
+  /* binary event trace of the memory hierarchy (-t) */
+  Trace trace;
+  /* Chrome trace-event timeline (-J) */
+  Timeline timeline;
+  /* per-instruction pipeline log for Konata (-K) */
+  Konata konata;
+  /* host time spent in each component (-x) */
+  Host_Profile host_profile;
+
+  /* output of the shell commands */
+  FILE *out;
+} Sim_Context;
+
+/* context of the simulation running on this thread */
+extern _Thread_local Sim_Context *sim;
+
+/* a fresh context whose commands print to out; it is not bound yet */
+Sim_Context *sim_context_create(FILE *out);
+
+/* release a context and everything its simulation allocated */
+void sim_context_free(Sim_Context *ctx);
+
+/* make ctx the context of the calling thread */
+void sim_context_bind(Sim_Context *ctx);
+
+#endif
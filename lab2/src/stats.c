@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "stats.h"
+
+static Stat *stats_register(Stats *s, const char *group, const char *name,
+                            Stat_Kind kind) {
+  int last_of_group = -1;
+
+  for (int i = 0; i < s->num_stats; ++i) {
+    Stat *stat = s->stats[i];
+    if (strcmp(stat->group, group) != 0)
+      continue;
+    if (strcmp(stat->name, name) == 0) {
+      if (stat->kind != kind) {
+        printf("Error: stat %s.%s registered twice\n", group, name);
+        exit(-1);
+      }
+      return stat;
+    }
+    last_of_group = i;
+  }
+
+  if (s->num_stats == s->max_stats) {
+    s->max_stats = s->max_stats ? 2 * s->max_stats : 64;
+    s->stats = (Stat **)realloc(s->stats, s->max_stats * sizeof(Stat *));
+  }
+
+  /* new groups go last, new stats of a group right after its others */
+  int pos = last_of_group >= 0 ? last_of_group + 1 : s->num_stats;
+  memmove(s->stats + pos + 1, s->stats + pos,
+          (s->num_stats - pos) * sizeof(Stat *));
+  s->num_stats++;
+
+  Stat *stat = (Stat *)calloc(1, sizeof(Stat));
+  stat->group = strdup(group);
+  stat->name = strdup(name);
+  stat->kind = kind;
+  s->stats[pos] = stat;
+  return stat;
+}
+
+Stat *stats_counter(Stats *s, const char *group, const char *name) {
+  return stats_register(s, group, name, STAT_COUNTER);
+}
+
+Stat *stats_average(Stats *s, const char *group, const char *name) {
+  return stats_register(s, group, name, STAT_AVERAGE);
+}
+
+Stat *stats_histogram(Stats *s, const char *group, const char *name,
+                      int num_buckets, int bucket_size) {
+  Stat *stat = stats_register(s, group, name, STAT_HISTOGRAM);
+  if (stat->buckets == NULL) {
+    stat->buckets = (uint64_t *)calloc(num_buckets, sizeof(uint64_t));
+    stat->num_buckets = num_buckets;
+    stat->bucket_size = bucket_size;
+  }
+  return stat;
+}
+
+Stat *stats_ratio(Stats *s, const char *group, const char *name, Stat *num,
+                  Stat *den) {
+  Stat *stat = stats_register(s, group, name, STAT_RATIO);
+  stat->num = num;
+  stat->den = den;
+  return stat;
+}
+
+Stat *stats_value(Stats *s, const char *group, const char *name,
+                  const uint32_t *source) {
+  Stat *stat = stats_register(s, group, name, STAT_VALUE);
+  stat->source = source;
+  return stat;
+}
+
+double stat_get(Stat *stat) {
+  double den;
+
+  switch (stat->kind) {
+  case STAT_COUNTER:
+    return stat->value;
+  case STAT_AVERAGE:
+  case STAT_HISTOGRAM:
+    return stat->samples ? (double)stat->value / stat->samples : 0.0;
+  case STAT_RATIO:
+    den = stat_get(stat->den);
+    return den != 0.0 ? stat_get(stat->num) / den : 0.0;
+  case STAT_VALUE:
+    return *stat->source;
+  }
+  return 0.0;
+}
+
+static void stats_write_json(Stats *s, uint64_t cycle, const char *indent) {
+  FILE *f = s->file;
+  const char *group = NULL;
+
+  fprintf(f, "{\"cycle\": %llu", (unsigned long long)cycle);
+  for (int i = 0; i < s->num_stats; ++i) {
+    Stat *stat = s->stats[i];
+
+    if (group == NULL || strcmp(group, stat->group) != 0) {
+      fprintf(f, "%s,\n%s  \"%s\": {", group ? "}" : "", indent, stat->group);
+      group = stat->group;
+    } else {
+      fprintf(f, ", ");
+    }
+
+    fprintf(f, "\"%s\": ", stat->name);
+    switch (stat->kind) {
+    case STAT_COUNTER:
+      fprintf(f, "%llu", (unsigned long long)stat->value);
+      break;
+    case STAT_VALUE:
+      fprintf(f, "%u", *stat->source);
+      break;
+    case STAT_RATIO:
+      fprintf(f, "%.6f", stat_get(stat));
+      break;
+    case STAT_AVERAGE:
+      fprintf(f, "{\"mean\": %.6f, \"samples\": %llu}", stat_get(stat),
+              (unsigned long long)stat->samples);
+      break;
+    case STAT_HISTOGRAM:
+      fprintf(f, "{\"mean\": %.6f, \"samples\": %llu, \"bucket_size\": %d, "
+                 "\"buckets\": [",
+              stat_get(stat), (unsigned long long)stat->samples,
+              stat->bucket_size);
+      for (int b = 0; b < stat->num_buckets; ++b)
+        fprintf(f, "%s%llu", b ? ", " : "",
+                (unsigned long long)stat->buckets[b]);
+      fprintf(f, "]}");
+      break;
+    }
+  }
+  fprintf(f, "%s}", group ? "}" : "");
+}
+
+// One row per number: averages and histograms get a row for the mean and for
+// the samples, histograms one more per bucket (named by its lower bound)
+static void stats_write_csv(Stats *s, const char *snapshot, uint64_t cycle) {
+  FILE *f = s->file;
+
+  for (int i = 0; i < s->num_stats; ++i) {
+    Stat *stat = s->stats[i];
+    fprintf(f, "%s,%llu,%s.%s", snapshot, (unsigned long long)cycle,
+            stat->group, stat->name);
+
+    switch (stat->kind) {
+    case STAT_COUNTER:
+      fprintf(f, ",%llu\n", (unsigned long long)stat->value);
+      break;
+    case STAT_VALUE:
+      fprintf(f, ",%u\n", *stat->source);
+      break;
+    case STAT_RATIO:
+      fprintf(f, ",%.6f\n", stat_get(stat));
+      break;
+    case STAT_AVERAGE:
+    case STAT_HISTOGRAM:
+      fprintf(f, ".mean,%.6f\n", stat_get(stat));
+      fprintf(f, "%s,%llu,%s.%s.samples,%llu\n", snapshot,
+              (unsigned long long)cycle, stat->group, stat->name,
+              (unsigned long long)stat->samples);
+      for (int b = 0; b < stat->num_buckets; ++b)
+        fprintf(f, "%s,%llu,%s.%s.%d,%llu\n", snapshot,
+                (unsigned long long)cycle, stat->group, stat->name,
+                b * stat->bucket_size, (unsigned long long)stat->buckets[b]);
+      break;
+    }
+  }
+}
+
+bool stats_open(Stats *s, const char *filename, uint64_t interval) {
+  size_t len = strlen(filename);
+
+  s->file = fopen(filename, "w");
+  if (s->file == NULL)
+    return false;
+
+  s->csv = len >= 4 && strcmp(filename + len - 4, ".csv") == 0;
+  s->interval = interval;
+  s->next_snapshot = interval;
+  s->num_snapshots = 0;
+
+  if (s->csv)
+    fprintf(s->file, "snapshot,cycle,stat,value\n");
+  else
+    fprintf(s->file, "{\n  \"intervals\": [");
+  return true;
+}
+
+void stats_snapshot(Stats *s, uint64_t cycle) {
+  if (s->csv) {
+    char snapshot[16];
+    snprintf(snapshot, sizeof(snapshot), "%d", s->num_snapshots);
+    stats_write_csv(s, snapshot, cycle);
+  } else {
+    fprintf(s->file, "%s\n    ", s->num_snapshots ? "," : "");
+    stats_write_json(s, cycle, "    ");
+  }
+
+  s->num_snapshots++;
+  while (s->next_snapshot <= cycle)
+    s->next_snapshot += s->interval;
+}
+
+bool stats_close(Stats *s, uint64_t cycle) {
+  if (s->csv) {
+    stats_write_csv(s, "final", cycle);
+  } else {
+    fprintf(s->file, "%s],\n  \"final\": ", s->num_snapshots ? "\n  " : "");
+    stats_write_json(s, cycle, "  ");
+    fprintf(s->file, "\n}\n");
+  }
+
+  bool ok = !ferror(s->file);
+  ok = fclose(s->file) == 0 && ok;
+  s->file = NULL;
+  s->interval = 0;
+  return ok;
+}
+
+/* ratios and values are computed from other stats or counters */
+static bool stats_is_saved(Stat *stat) {
+  return stat->kind != STAT_RATIO && stat->kind != STAT_VALUE;
+}
+
+static void stats_save_string(Checkpoint *ck, const char *str) {
+  uint32_t len = strlen(str);
+  checkpoint_write_value(ck, len);
+  checkpoint_write(ck, str, len);
+}
+
+/* the string in place in the mapped checkpoint, not NUL terminated */
+static const char *stats_restore_string(Checkpoint *ck, uint32_t *len) {
+  checkpoint_read_value(ck, *len);
+  return (const char *)checkpoint_read_mapped(ck, *len);
+}
+
+static bool stats_name_is(const char *name, const char *str, uint32_t len) {
+  return strlen(name) == len && memcmp(name, str, len) == 0;
+}
+
+void stats_save(Stats *s, Checkpoint *ck) {
+  int32_t num_saved = 0;
+
+  for (int i = 0; i < s->num_stats; ++i)
+    num_saved += stats_is_saved(s->stats[i]);
+  checkpoint_write_value(ck, num_saved);
+
+  for (int i = 0; i < s->num_stats; ++i) {
+    Stat *stat = s->stats[i];
+    if (!stats_is_saved(stat))
+      continue;
+    stats_save_string(ck, stat->group);
+    stats_save_string(ck, stat->name);
+    checkpoint_write_value(ck, stat->kind);
+    checkpoint_write_value(ck, stat->value);
+    checkpoint_write_value(ck, stat->samples);
+    checkpoint_write_value(ck, stat->num_buckets);
+    checkpoint_write(ck, stat->buckets, stat->num_buckets * sizeof(uint64_t));
+  }
+}
+
+// Saved stats are matched by name and kind; one only registered in this run
+// (e.g. for a new -p range) counts from the restore, one only in the
+// checkpoint is dropped
+void stats_restore(Stats *s, Checkpoint *ck) {
+  int32_t num_saved;
+
+  checkpoint_read_value(ck, num_saved);
+  for (int k = 0; k < num_saved; ++k) {
+    uint32_t group_len, name_len;
+    const char *group = stats_restore_string(ck, &group_len);
+    const char *name = stats_restore_string(ck, &name_len);
+    Stat_Kind kind;
+    uint64_t value, samples;
+    int num_buckets;
+    Stat *stat = NULL;
+
+    checkpoint_read_value(ck, kind);
+    checkpoint_read_value(ck, value);
+    checkpoint_read_value(ck, samples);
+    checkpoint_read_value(ck, num_buckets);
+    if (num_buckets < 0) {
+      printf("Error: checkpoint is corrupt\n");
+      exit(-1);
+    }
+
+    for (int i = 0; i < s->num_stats; ++i) {
+      if (stats_name_is(s->stats[i]->group, group, group_len) &&
+          stats_name_is(s->stats[i]->name, name, name_len)) {
+        stat = s->stats[i];
+        break;
+      }
+    }
+
+    if (stat && stat->kind == kind && stat->num_buckets == num_buckets) {
+      stat->value = value;
+      stat->samples = samples;
+      checkpoint_read(ck, stat->buckets, num_buckets * sizeof(uint64_t));
+    } else {
+      checkpoint_read_mapped(ck, num_buckets * sizeof(uint64_t));
+    }
+  }
+}
+
+void stats_free(Stats *s) {
+  if (s->file)
+    fclose(s->file);
+  for (int i = 0; i < s->num_stats; ++i) {
+    free(s->stats[i]->group);
+    free(s->stats[i]->name);
+    free(s->stats[i]->buckets);
+    free(s->stats[i]);
+  }
+  free(s->stats);
+  memset(s, 0, sizeof(Stats));
+}
@@ -0,0 +1,119 @@
+/*
+ * Statistics registry
+ *
+ * Components register their stats at init under a group (e.g. "l1d") and
+ * keep the returned Stat pointers to update them. The registry belongs to the
+ * simulation context, so stats outlive the components: registering a name
+ * again (e.g. when a checkpoint rebuilds the hierarchy) returns the existing
+ * stat. Stats are part of checkpoints, so after a restore they count from the
+ * start of the simulation that was checkpointed, like the cycle count.
+ *
+ * With a dump file, the registry writes a snapshot of every stat every
+ * interval cycles and once more at the end of the run, as JSON or (for a
+ * file ending in .csv) CSV. Snapshots are cumulative.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
+
+typedef enum Stat_Kind {
+  STAT_COUNTER,   /* number of events */
+  STAT_AVERAGE,   /* mean of weighted samples, e.g. a queue depth per cycle */
+  STAT_HISTOGRAM, /* samples in buckets of bucket_size, and their mean */
+  STAT_RATIO,     /* num / den, computed when dumped */
+  STAT_VALUE      /* a counter kept elsewhere, e.g. the cycle count */
+} Stat_Kind;
+
+struct Stat {
+  char *group;
+  char *name;
+  Stat_Kind kind;
+  /* counter: events; average/histogram: weighted sum of the samples */
+  uint64_t value;
+  /* average/histogram: total weight of the samples */
+  uint64_t samples;
+  /* histogram: the last bucket also takes every larger sample */
+  uint64_t *buckets;
+  int num_buckets;
+  int bucket_size;
+  /* ratio */
+  Stat *num, *den;
+  /* value */
+  const uint32_t *source;
+};
+
+struct Stats {
+  /* in dump order, the stats of a group are kept together */
+  Stat **stats;
+  int num_stats;
+  int max_stats;
+
+  /* dump file (NULL for none) and its format */
+  FILE *file;
+  bool csv;
+  /* cycles between snapshots (0 for none) and the cycle of the next one */
+  uint64_t interval;
+  uint64_t next_snapshot;
+  int num_snapshots;
+};
+
+/* register a stat, or look up the one already registered under that name */
+Stat *stats_counter(Stats *s, const char *group, const char *name);
+Stat *stats_average(Stats *s, const char *group, const char *name);
+Stat *stats_histogram(Stats *s, const char *group, const char *name,
+                      int num_buckets, int bucket_size);
+Stat *stats_ratio(Stats *s, const char *group, const char *name, Stat *num,
+                  Stat *den);
+Stat *stats_value(Stats *s, const char *group, const char *name,
+                  const uint32_t *source);
+
+/* count events */
+static inline void stat_add(Stat *stat, uint64_t n) { stat->value += n; }
+static inline void stat_inc(Stat *stat) { stat->value++; }
+
+/* record value weight times, e.g. once for each of weight cycles */
+static inline void stat_sample(Stat *stat, uint64_t value, uint64_t weight) {
+  stat->value += value * weight;
+  stat->samples += weight;
+  if (stat->kind == STAT_HISTOGRAM) {
+    uint64_t bucket = value / stat->bucket_size;
+    if (bucket >= (uint64_t)stat->num_buckets)
+      bucket = stat->num_buckets - 1;
+    stat->buckets[bucket] += weight;
+  }
+}
+
+/* counter or value as is, the mean of an average or histogram, or a ratio */
+double stat_get(Stat *stat);
+
+/* start dumping to filename, with a snapshot every interval cycles if not 0;
+ * false if the file can't be created */
+bool stats_open(Stats *s, const char *filename, uint64_t interval);
+
+/* write an interval snapshot taken at cycle */
+void stats_snapshot(Stats *s, uint64_t cycle);
+
+/* take the interval snapshot once cycle reaches it */
+static inline void stats_tick(Stats *s, uint64_t cycle) {
+  if (s->interval && cycle >= s->next_snapshot)
+    stats_snapshot(s, cycle);
+}
+
+/* write the final snapshot and close the dump file, false on a write error */
+bool stats_close(Stats *s, uint64_t cycle);
+
+/* write the stats to a checkpoint, or set the ones registered so far to the
+ * values in it */
+void stats_save(Stats *s, Checkpoint *ck);
+void stats_restore(Stats *s, Checkpoint *ck);
+
+/* release all stats (and the dump file, without a final snapshot) */
+void stats_free(Stats *s);
+
+#endif
@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "timeline.h"
+
+/* process ids of the track groups */
+#define TIMELINE_PID_PIPE 1
+#define TIMELINE_PID_DRAM 2
+#define TIMELINE_PID_HIERARCHY 3
+
+static const char *timeline_stage_names[TIMELINE_NUM_STAGES] = {
+    "decode", "execute", "mem", "wb"};
+static const char *timeline_counter_names[TIMELINE_NUM_COUNTERS] = {
+    "interconnect in flight", "l2 mshrs"};
+
+static void timeline_name(Timeline *t, const char *what, int pid, int tid,
+                          const char *name) {
+  fprintf(t->file,
+          "{\"ph\":\"M\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+          "\"args\":{\"name\":\"%s\"}},\n",
+          what, pid, tid, name);
+}
+
+bool timeline_open(Timeline *t, const char *filename) {
+  char name[16];
+
+  memset(t, 0, sizeof(Timeline));
+  t->file = fopen(filename, "w");
+  if (t->file == NULL)
+    return false;
+
+  for (int c = 0; c < TIMELINE_NUM_COUNTERS; ++c)
+    t->counters[c] = -1;
+
+  fprintf(t->file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  timeline_name(t, "process_name", TIMELINE_PID_PIPE, 0, "pipeline");
+  for (int s = 0; s < TIMELINE_NUM_STAGES; ++s)
+    timeline_name(t, "thread_name", TIMELINE_PID_PIPE, s,
+                  timeline_stage_names[s]);
+
+  timeline_name(t, "process_name", TIMELINE_PID_DRAM, 0, "dram");
+  for (int b = 0; b < TIMELINE_CMD_BUS; ++b) {
+    snprintf(name, sizeof(name), "bank %d", b);
+    timeline_name(t, "thread_name", TIMELINE_PID_DRAM, b, name);
+  }
+  timeline_name(t, "thread_name", TIMELINE_PID_DRAM, TIMELINE_CMD_BUS,
+                "command bus");
+  timeline_name(t, "thread_name", TIMELINE_PID_DRAM, TIMELINE_DATA_BUS,
+                "data bus");
+
+  timeline_name(t, "process_name", TIMELINE_PID_HIERARCHY, 0, "hierarchy");
+  return true;
+}
+
+static void timeline_end_stage(Timeline *t, Timeline_Stage stage,
+                               uint64_t cycle) {
+  Timeline_Occupant *o = t->stages + stage;
+  if (o->op == NULL)
+    return;
+
+  fprintf(t->file,
+          "{\"ph\":\"X\",\"name\":\"0x%08x\",\"pid\":%d,\"tid\":%d,"
+          "\"ts\":%llu,\"dur\":%llu},\n",
+          o->pc, TIMELINE_PID_PIPE, stage, (unsigned long long)o->start,
+          (unsigned long long)(cycle - o->start));
+  o->op = NULL;
+}
+
+// Ops come from a pool, but one that leaves a stage is never replaced by the
+// same pointer in the same cycle: the slot is empty at the end of a cycle in
+// which an op got squashed
+void timeline_stage(Timeline *t, Timeline_Stage stage, const void *op,
+                    uint32_t pc, uint64_t cycle) {
+  Timeline_Occupant *o = t->stages + stage;
+  if (o->op == op && (op == NULL || o->pc == pc))
+    return;
+
+  timeline_end_stage(t, stage, cycle);
+  if (op != NULL) {
+    o->op = op;
+    o->pc = pc;
+    o->start = cycle;
+  }
+}
+
+void timeline_counter(Timeline *t, Timeline_Counter counter, int64_t value,
+                      uint64_t cycle) {
+  if (t->counters[counter] == value)
+    return;
+
+  t->counters[counter] = value;
+  fprintf(t->file,
+          "{\"ph\":\"C\",\"name\":\"%s\",\"pid\":%d,\"ts\":%llu,"
+          "\"args\":{\"value\":%lld}},\n",
+          timeline_counter_names[counter], TIMELINE_PID_HIERARCHY,
+          (unsigned long long)cycle, (long long)value);
+}
+
+void timeline_dram(Timeline *t, int tid, const char *name, uint32_t addr,
+                   int start, int end) {
+  fprintf(t->file,
+          "{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%d,"
+          "\"dur\":%d,\"args\":{\"addr\":\"0x%08x\"}},\n",
+          name, TIMELINE_PID_DRAM, tid, start, end - start + 1, addr);
+}
+
+bool timeline_close(Timeline *t, uint64_t cycle) {
+  if (t->file == NULL)
+    return true;
+
+  for (int s = 0; s < TIMELINE_NUM_STAGES; ++s)
+    timeline_end_stage(t, s, cycle);
+
+  /* JSON has no trailing commas, the last event closes the list */
+  fprintf(t->file,
+          "{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":%d,"
+          "\"args\":{\"sort_index\":0}}\n]}\n",
+          TIMELINE_PID_PIPE);
+
+  bool ok = !ferror(t->file);
+  ok = fclose(t->file) == 0 && ok;
+  t->file = NULL;
+  return ok;
+}
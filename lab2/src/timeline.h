@@ -0,0 +1,79 @@
+/*
+ * Timeline export
+ *
+ * Writes what the machine is doing over time as a Chrome trace-event JSON
+ * file, which Perfetto (ui.perfetto.dev) and chrome://tracing load. One
+ * simulated cycle is shown as one microsecond.
+ *
+ * - pipeline: a track per stage input (decode, execute, mem, wb) with a slice
+ *   for every op while it occupies it, named by its PC
+ * - dram: a track per bank with the bank busy interval of every request and
+ *   its PRECHARGE/ACTIVATE/READ-WRITE commands nested inside, plus tracks for
+ *   the command and data buses
+ * - hierarchy: counters of the interconnect messages in flight and of the
+ *   allocated L2 MSHRs
+ */
+
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "memory.h"
+
+typedef enum Timeline_Stage {
+  TIMELINE_DECODE,
+  TIMELINE_EXECUTE,
+  TIMELINE_MEM,
+  TIMELINE_WB,
+  TIMELINE_NUM_STAGES
+} Timeline_Stage;
+
+typedef enum Timeline_Counter {
+  TIMELINE_IN_FLIGHT,
+  TIMELINE_MSHRS,
+  TIMELINE_NUM_COUNTERS
+} Timeline_Counter;
+
+/* DRAM tracks after the banks */
+#define TIMELINE_CMD_BUS MEM_NUM_BANKS
+#define TIMELINE_DATA_BUS (MEM_NUM_BANKS + 1)
+
+/* an op in a stage, from the cycle it got there */
+typedef struct Timeline_Occupant {
+  const void *op;
+  uint32_t pc;
+  uint64_t start;
+} Timeline_Occupant;
+
+struct Timeline {
+  FILE *file;
+  Timeline_Occupant stages[TIMELINE_NUM_STAGES];
+  int64_t counters[TIMELINE_NUM_COUNTERS];
+};
+
+/* start writing a timeline to filename, false if it can't be created */
+bool timeline_open(Timeline *t, const char *filename);
+
+static inline bool timeline_enabled(Timeline *t) { return t->file != NULL; }
+
+/* op (NULL for none) is at the input of stage from cycle on */
+void timeline_stage(Timeline *t, Timeline_Stage stage, const void *op,
+                    uint32_t pc, uint64_t cycle);
+
+/* a counter has value from cycle on; only changes are written */
+void timeline_counter(Timeline *t, Timeline_Counter counter, int64_t value,
+                      uint64_t cycle);
+
+/* a DRAM interval [start, end] (both included) named name on track tid, with
+ * the block address as its argument */
+void timeline_dram(Timeline *t, int tid, const char *name, uint32_t addr,
+                   int start, int end);
+
+/* end the open slices at cycle and close the file, false on a write error */
+bool timeline_close(Timeline *t, uint64_t cycle);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+const char *trace_component_names[TRACE_NUM_COMPONENTS] = {"l1i", "l1d", "l2",
+                                                           "mem", "int"};
+
+const char *trace_event_names[TRACE_NUM_EVENTS] = {
+    [TRACE_L1_HIT] = "hit",
+    [TRACE_L1_MISS] = "miss",
+    [TRACE_L1_INSERT] = "insert",
+    [TRACE_L1_CANCEL] = "cancel",
+    [TRACE_L2_HIT] = "hit",
+    [TRACE_L2_MISS] = "miss",
+    [TRACE_L2_MSHR_FULL] = "mshr_full",
+    [TRACE_L2_MSHR_PENDING] = "mshr_pending",
+    [TRACE_L2_MSHR_ALLOC] = "mshr_alloc",
+    [TRACE_L2_MSHR_MERGE] = "mshr_merge",
+    [TRACE_L2_INSERT] = "insert",
+    [TRACE_MEM_REQUEST] = "request",
+    [TRACE_MEM_SCHEDULE] = "schedule",
+    [TRACE_MEM_DONE] = "done",
+    [TRACE_INT_SEND] = "send",
+    [TRACE_INT_DELIVER] = "deliver"};
+
+bool trace_parse_components(const char *list, uint32_t *components) {
+  char *names = strdup(list), *save;
+  bool ok = true;
+
+  *components = 0;
+  for (char *name = strtok_r(names, ",", &save); name;
+       name = strtok_r(NULL, ",", &save)) {
+    int c;
+    if (strcmp(name, "all") == 0) {
+      *components |= (1u << TRACE_NUM_COMPONENTS) - 1;
+      continue;
+    }
+    if (strcmp(name, "l1") == 0) {
+      *components |= (1u << TRACE_L1I) | (1u << TRACE_L1D);
+      continue;
+    }
+    for (c = 0; c < TRACE_NUM_COMPONENTS; ++c) {
+      if (strcmp(name, trace_component_names[c]) == 0)
+        break;
+    }
+    if (c == TRACE_NUM_COMPONENTS) {
+      ok = false;
+      break;
+    }
+    *components |= 1u << c;
+  }
+
+  free(names);
+  return ok;
+}
+
+bool trace_open(Trace *t, const char *filename, uint32_t components,
+                const uint32_t *cycle) {
+  Trace_Header h;
+
+  t->file = fopen(filename, "wb");
+  if (t->file == NULL)
+    return false;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  h.version = TRACE_VERSION;
+  h.record_size = sizeof(Trace_Record);
+  fwrite(&h, sizeof(h), 1, t->file);
+
+  t->ring = (Trace_Record *)malloc(TRACE_RING_SIZE * sizeof(Trace_Record));
+  t->ring_count = 0;
+  t->num_records = 0;
+  t->cycle = cycle;
+  t->components = components;
+  return true;
+}
+
+static void trace_drain(Trace *t) {
+  fwrite(t->ring, sizeof(Trace_Record), t->ring_count, t->file);
+  t->ring_count = 0;
+}
+
+void trace_record(Trace *t, Trace_Component component, Trace_Event event,
+                  uint32_t addr, uint32_t extra) {
+  if (t->ring_count == TRACE_RING_SIZE)
+    trace_drain(t);
+
+  Trace_Record *r = t->ring + t->ring_count++;
+  r->cycle = *t->cycle;
+  r->component = component;
+  r->event = event;
+  r->reserved = 0;
+  r->addr = addr;
+  r->extra = extra;
+  t->num_records++;
+}
+
+bool trace_close(Trace *t) {
+  bool ok = true;
+
+  if (t->file) {
+    trace_drain(t);
+    ok = !ferror(t->file);
+    ok = fclose(t->file) == 0 && ok;
+  }
+  free(t->ring);
+  memset(t, 0, sizeof(Trace));
+  return ok;
+}
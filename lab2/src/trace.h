@@ -0,0 +1,116 @@
+/*
+ * Event trace
+ *
+ * Components report what happens to a block (hit, miss, MSHR allocated, DRAM
+ * request scheduled, ...) as fixed-size binary records. Tracing is switched
+ * on at run time per component; a component that isn't traced pays one test
+ * of a bit mask per event. Records go into a ring buffer that is drained to
+ * the trace file whenever it fills up, so a traced run costs a copy of 16
+ * bytes per event instead of a printf.
+ *
+ * The file starts with a Trace_Header followed by the records. trace_decode
+ * renders it as text.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.h"
+
+#define TRACE_MAGIC "MIPSTRCE"
+#define TRACE_VERSION 2
+
+/* records in the ring buffer */
+#define TRACE_RING_SIZE 4096
+
+typedef enum Trace_Component {
+  TRACE_L1I,
+  TRACE_L1D,
+  TRACE_L2,
+  TRACE_MEM,
+  TRACE_INT,
+  TRACE_NUM_COMPONENTS
+} Trace_Component;
+
+/* what extra holds is given for each event; set/way is set << 8 | way */
+typedef enum Trace_Event {
+  TRACE_L1_HIT,          /* set/way */
+  TRACE_L1_MISS,         /* set */
+  TRACE_L1_INSERT,       /* set/way the block went to */
+  TRACE_L1_CANCEL,       /* - */
+  TRACE_L2_HIT,          /* set/way */
+  TRACE_L2_MISS,         /* set */
+  TRACE_L2_MSHR_FULL,    /* - */
+  TRACE_L2_MSHR_PENDING, /* index of the MSHR already allocated */
+  TRACE_L2_MSHR_ALLOC,   /* MSHR index */
+  TRACE_L2_MSHR_MERGE,   /* index of the MSHR the other L1 allocated */
+  TRACE_L2_INSERT,       /* set/way the block went to */
+  TRACE_MEM_REQUEST,     /* bank */
+  TRACE_MEM_SCHEDULE,    /* row buffer status << 8 | bank */
+  TRACE_MEM_DONE,        /* bank */
+  TRACE_INT_SEND,        /* direction << 16 | latency */
+  TRACE_INT_DELIVER,     /* direction */
+  TRACE_NUM_EVENTS
+} Trace_Event;
+
+typedef struct Trace_Record {
+  uint32_t cycle;
+  uint8_t component;
+  uint8_t event;
+  uint16_t reserved;
+  /* block address */
+  uint32_t addr;
+  uint32_t extra;
+} Trace_Record;
+
+typedef struct Trace_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+} Trace_Header;
+
+struct Trace {
+  /* bit (1 << component) is set for every traced component */
+  uint32_t components;
+  /* the cycle counter the records are stamped with */
+  const uint32_t *cycle;
+
+  FILE *file;
+  Trace_Record *ring;
+  int ring_count;
+  uint64_t num_records;
+};
+
+/* names of the components and events, as used by -T and trace_decode */
+extern const char *trace_component_names[TRACE_NUM_COMPONENTS];
+extern const char *trace_event_names[TRACE_NUM_EVENTS];
+
+/* component mask for a comma-separated list of names ("l1" for both L1s,
+ * "all" for everything); false on an unknown name */
+bool trace_parse_components(const char *list, uint32_t *components);
+
+/* start tracing the given components to filename, stamping the records with
+ * *cycle; false if the file can't be created */
+bool trace_open(Trace *t, const char *filename, uint32_t components,
+                const uint32_t *cycle);
+
+/* append a record, draining the ring to the file when it is full */
+void trace_record(Trace *t, Trace_Component component, Trace_Event event,
+                  uint32_t addr, uint32_t extra);
+
+static inline void trace_event(Trace *t, Trace_Component component,
+                               Trace_Event event, uint32_t addr,
+                               uint32_t extra) {
+  if (t->components & (1u << component))
+    trace_record(t, component, event, addr, extra);
+}
+
+/* write what is left in the ring and close the file, false on a write
+ * error; tracing stops */
+bool trace_close(Trace *t);
+
+#endif
@@ -0,0 +1,552 @@
+/*
+ * Microbenchmarks of the memory hierarchy hot paths and of the whole
+ * pipeline, to tell whether a change made the simulator slower.
+ *
+ * Every benchmark runs its operation in batches until it has been timed for
+ * a while (-t) and reports the host time per operation, best of -r runs. The
+ * state a batch needs (e.g. messages in flight) is set up between the timed
+ * parts. The pipeline benchmarks run each program for up to -n cycles and
+ * also report simulated kilo-instructions per host second.
+ *
+ * usage: microbench [-t seconds] [-r runs] [-n cycles] [-o json]
+ *                   [-b baseline] [programs]
+ *
+ * -o writes the results as JSON, -b reads such a file and prints how far
+ * each benchmark moved from it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shell.h"
+#include "sim.h"
+
+#define BENCH_MAX_RESULTS 64
+#define BENCH_NAME_SIZE 64
+
+typedef struct Bench_Result {
+  char name[BENCH_NAME_SIZE];
+  double ns_per_op;
+  uint64_t ops;
+  /* simulated KIPS, 0 for the component benchmarks */
+  double kips;
+} Bench_Result;
+
+/* time accumulated over the timed parts of one run */
+typedef struct Bench_Timer {
+  double elapsed;
+  uint64_t ops;
+  struct timespec start;
+} Bench_Timer;
+
+static double bench_min_seconds = 0.2;
+static int bench_runs = 3;
+static uint32_t bench_max_cycles = 1000000;
+
+static Bench_Result results[BENCH_MAX_RESULTS];
+static int num_results;
+
+static bool bench_more(Bench_Timer *t) {
+  return t->elapsed < bench_min_seconds;
+}
+
+static void bench_start(Bench_Timer *t) {
+  clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+static void bench_stop(Bench_Timer *t, uint64_t ops) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  t->elapsed += (end.tv_sec - t->start.tv_sec) +
+                (end.tv_nsec - t->start.tv_nsec) * 1e-9;
+  t->ops += ops;
+}
+
+/* a fresh simulator context with an initialized hierarchy and no program;
+ * l2_mshrs is the number of L2 MSHRs, the default if 0 */
+static FILE *bench_null;
+
+static void bench_context_create(int l2_mshrs) {
+  sim_context_bind(sim_context_create(bench_null));
+  if (l2_mshrs)
+    sim->l2_mshrs = l2_mshrs;
+  pipe_init();
+}
+
+static void bench_context_free() { sim_context_free(sim); }
+
+/* one cycle of the interconnect: the messages due get delivered */
+static void bench_interconnect_tick() {
+  interconnect_cycle(&sim->interconnect);
+  event_run(&sim->events);
+  event_advance(&sim->events, 1);
+}
+
+/* drop the messages in flight; their blocks belong to the benchmark */
+static void bench_interconnect_reset(Interconnect_State *i) {
+  event_queue_free(&sim->events);
+  event_queue_init(&sim->events);
+  i->num_messages = 0;
+}
+
+/* drop all DRAM requests and their events; their blocks belong to the
+ * benchmark */
+static void bench_memory_reset(Memory_State *m) {
+  event_queue_free(&sim->events);
+  event_queue_init(&sim->events);
+  memory_free(m);
+  m->pending_requests = list_new();
+  m->ongoing_requests = list_new();
+  memset(m->banks, 0, sizeof(m->banks));
+  m->curr_cycle = 0;
+}
+
+/* blocks that miss everywhere: a stream over addresses never used before */
+static uint32_t bench_next_tag = 0x20000000;
+
+static Cache_Block *bench_new_block(L1_Cache_State *l1) {
+  Cache_Block *b = (Cache_Block *)malloc(sizeof(Cache_Block));
+  b->tag = bench_next_tag;
+  b->l1 = l1;
+  b->pc = 0;
+  bench_next_tag += CACHE_BLOCK_SIZE;
+  return b;
+}
+
+/* a hot set of lines that stays in the D$, plus a region that is in L2 */
+#define BENCH_HOT_LINES 64
+#define BENCH_HOT_BASE 0x10000000
+#define BENCH_L2_BASE 0x10100000
+#define BENCH_L2_LINES 4096
+
+/******************************************************************************/
+/* L1                                                                         */
+/******************************************************************************/
+
+/* every access hits */
+static void bench_l1_access_hit(Bench_Timer *t, int arg) {
+  L1_Cache_State *c = &sim->data_cache;
+  (void)arg;
+
+  for (int l = 0; l < BENCH_HOT_LINES; ++l)
+    l1_cache_warm(c, BENCH_HOT_BASE + l * CACHE_BLOCK_SIZE);
+
+  while (bench_more(t)) {
+    bench_start(t);
+    for (int n = 0; n < 4096; ++n)
+      l1_cache_access(c, BENCH_HOT_BASE + (n % BENCH_HOT_LINES) *
+                                              CACHE_BLOCK_SIZE, 0);
+    bench_stop(t, 4096);
+  }
+}
+
+/* one in arg accesses misses L1 and hits L2, which sends the block back; the
+ * blocks get delivered between the batches */
+static void bench_l1_access_mix(Bench_Timer *t, int arg) {
+  L1_Cache_State *c = &sim->data_cache;
+  int next_l2_line = 0;
+
+  for (int l = 0; l < BENCH_HOT_LINES; ++l)
+    l1_cache_warm(c, BENCH_HOT_BASE + l * CACHE_BLOCK_SIZE);
+  for (int l = 0; l < BENCH_L2_LINES; ++l)
+    l2_cache_warm(&sim->l2_cache, BENCH_L2_BASE + l * CACHE_BLOCK_SIZE);
+
+  while (bench_more(t)) {
+    bench_start(t);
+    for (int n = 0; n < 1024; ++n) {
+      uint32_t addr;
+      if (n % arg == 0) {
+        addr = BENCH_L2_BASE + next_l2_line * CACHE_BLOCK_SIZE;
+        next_l2_line = (next_l2_line + 1) % BENCH_L2_LINES;
+      } else {
+        addr = BENCH_HOT_BASE + (n % BENCH_HOT_LINES) * CACHE_BLOCK_SIZE;
+      }
+      l1_cache_access(c, addr, 0);
+    }
+    bench_stop(t, 1024);
+
+    while (interconnect_in_flight(&sim->interconnect))
+      bench_interconnect_tick();
+  }
+}
+
+/* a stalled stage accessing a line whose block is still on its way */
+static void bench_l1_access_pending(Bench_Timer *t, int arg) {
+  L1_Cache_State *c = &sim->data_cache;
+  uint32_t addr = bench_next_tag;
+  (void)arg;
+
+  bench_next_tag += CACHE_BLOCK_SIZE;
+  l1_cache_access(c, addr, 0);
+
+  while (bench_more(t)) {
+    bench_start(t);
+    for (int n = 0; n < 4096; ++n)
+      l1_cache_access(c, addr, 0);
+    bench_stop(t, 4096);
+  }
+}
+
+/* blocks of new lines, so that inserting evicts the LRU way */
+static void bench_l1_insert_block(Bench_Timer *t, int arg) {
+  Cache_Block *blocks[256];
+  (void)arg;
+
+  while (bench_more(t)) {
+    for (int n = 0; n < 256; ++n)
+      blocks[n] = bench_new_block(&sim->data_cache);
+
+    bench_start(t);
+    for (int n = 0; n < 256; ++n)
+      l1_insert_block(blocks[n]);
+    bench_stop(t, 256);
+  }
+}
+
+/******************************************************************************/
+/* L2                                                                         */
+/******************************************************************************/
+
+/* every probe hits and sends its block to L1 */
+static void bench_l2_probe_hit(Bench_Timer *t, int arg) {
+  static Cache_Block blocks[BENCH_L2_LINES];
+  (void)arg;
+
+  for (int l = 0; l < BENCH_L2_LINES; ++l) {
+    blocks[l].tag = BENCH_L2_BASE + l * CACHE_BLOCK_SIZE;
+    blocks[l].l1 = &sim->data_cache;
+    l2_cache_warm(&sim->l2_cache, blocks[l].tag);
+  }
+
+  while (bench_more(t)) {
+    bench_start(t);
+    for (int l = 0; l < BENCH_L2_LINES; ++l)
+      l2_cache_probe(&sim->l2_cache, blocks + l);
+    bench_stop(t, BENCH_L2_LINES);
+
+    bench_interconnect_reset(&sim->interconnect);
+  }
+}
+
+/* the probe of an L1 miss that is still waiting on its MSHR, with all but
+ * one MSHR allocated; L2 frees the repeated probes */
+static void bench_l2_probe_pending(Bench_Timer *t, int arg) {
+  int num_blocks = sim->l2_cache.num_mshrs - 1;
+  Cache_Block *blocks = (Cache_Block *)calloc(num_blocks, sizeof(Cache_Block));
+  Cache_Block *probes[4096];
+  (void)arg;
+
+  for (int n = 0; n < num_blocks; ++n) {
+    blocks[n].tag = bench_next_tag;
+    blocks[n].l1 = &sim->data_cache;
+    bench_next_tag += CACHE_BLOCK_SIZE;
+    l2_cache_probe(&sim->l2_cache, blocks + n);
+  }
+  bench_interconnect_reset(&sim->interconnect);
+
+  while (bench_more(t)) {
+    for (int n = 0; n < 4096; ++n) {
+      probes[n] = (Cache_Block *)malloc(sizeof(Cache_Block));
+      *probes[n] = blocks[n % num_blocks];
+    }
+
+    bench_start(t);
+    for (int n = 0; n < 4096; ++n)
+      l2_cache_probe(&sim->l2_cache, probes[n]);
+    bench_stop(t, 4096);
+  }
+
+  free(blocks);
+}
+
+/* fills of new lines that free their MSHR and go on to L1 */
+static void bench_l2_insert_block(Bench_Timer *t, int arg) {
+  int num_mshrs = sim->l2_cache.num_mshrs;
+  Cache_Block **blocks = (Cache_Block **)calloc(num_mshrs, sizeof(Cache_Block *));
+  (void)arg;
+
+  while (bench_more(t)) {
+    for (int n = 0; n < num_mshrs; ++n) {
+      blocks[n] = bench_new_block(&sim->data_cache);
+      l2_cache_probe(&sim->l2_cache, blocks[n]);
+    }
+    bench_interconnect_reset(&sim->interconnect);
+
+    bench_start(t);
+    for (int n = 0; n < num_mshrs; ++n)
+      l2_insert_block(&sim->l2_cache, blocks[n]);
+    bench_stop(t, num_mshrs);
+  }
+  free(blocks);
+}
+
+/******************************************************************************/
+/* interconnect and DRAM                                                      */
+/******************************************************************************/
+
+/* cycles with arg L2 to L1 messages in flight, none of them due yet */
+static void bench_interconnect_cycle(Bench_Timer *t, int arg) {
+  Cache_Block *blocks = (Cache_Block *)calloc(arg + 1, sizeof(Cache_Block));
+
+  while (bench_more(t)) {
+    for (int n = 0; n < arg; ++n)
+      interconnect_l2_to_l1(&sim->interconnect, blocks + n);
+
+    /* L2 to L1 messages take 15 cycles */
+    bench_start(t);
+    for (int n = 0; n < 14; ++n)
+      bench_interconnect_tick();
+    bench_stop(t, 14);
+
+    bench_interconnect_reset(&sim->interconnect);
+  }
+  free(blocks);
+}
+
+/* cycles with arg requests pending (arg - 1 once the first one is
+ * scheduled), spread over the banks; none of them completes in a batch */
+static void bench_memory_cycle(Bench_Timer *t, int arg) {
+  Cache_Block *blocks = (Cache_Block *)calloc(arg + 1, sizeof(Cache_Block));
+
+  for (int n = 0; n < arg; ++n)
+    blocks[n].tag = (n << 16) | ((n % MEM_NUM_BANKS) << 5);
+
+  while (bench_more(t)) {
+    for (int n = 0; n < arg; ++n)
+      memory_add_request(&sim->memory, blocks + n);
+
+    bench_start(t);
+    for (int n = 0; n < 32; ++n)
+      memory_cycle(&sim->memory);
+    bench_stop(t, 32);
+
+    bench_memory_reset(&sim->memory);
+  }
+  free(blocks);
+}
+
+/******************************************************************************/
+/* runner                                                                     */
+/******************************************************************************/
+
+typedef void (*Bench_Fn)(Bench_Timer *t, int arg);
+
+typedef struct Bench {
+  const char *name;
+  Bench_Fn fn;
+  int arg;
+  /* L2 MSHRs of its context, the default if 0 */
+  int l2_mshrs;
+} Bench;
+
+static Bench benchmarks[] = {
+    {"l1_cache_access/hit", bench_l1_access_hit, 0, 0},
+    {"l1_cache_access/miss_1_in_10", bench_l1_access_mix, 10, 0},
+    {"l1_cache_access/miss_1_in_2", bench_l1_access_mix, 2, 0},
+    {"l1_cache_access/pending", bench_l1_access_pending, 0, 0},
+    {"l1_insert_block", bench_l1_insert_block, 0, 0},
+    {"l2_cache_probe/hit", bench_l2_probe_hit, 0, 0},
+    {"l2_cache_probe/mshr_pending/16", bench_l2_probe_pending, 0, 16},
+    {"l2_cache_probe/mshr_pending/64", bench_l2_probe_pending, 0, 64},
+    {"l2_cache_probe/mshr_pending/256", bench_l2_probe_pending, 0, 256},
+    {"l2_insert_block/16", bench_l2_insert_block, 0, 16},
+    {"l2_insert_block/256", bench_l2_insert_block, 0, 256},
+    {"interconnect_cycle/0", bench_interconnect_cycle, 0, 0},
+    {"interconnect_cycle/16", bench_interconnect_cycle, 16, 0},
+    {"interconnect_cycle/64", bench_interconnect_cycle, 64, 0},
+    {"memory_cycle/0", bench_memory_cycle, 0, 0},
+    {"memory_cycle/8", bench_memory_cycle, 8, 0},
+    {"memory_cycle/32", bench_memory_cycle, 32, 0},
+};
+
+static Bench_Result *bench_result(const char *name) {
+  if (num_results == BENCH_MAX_RESULTS) {
+    printf("Error: more than %d benchmarks\n", BENCH_MAX_RESULTS);
+    exit(1);
+  }
+  Bench_Result *r = results + num_results++;
+  memset(r, 0, sizeof(Bench_Result));
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  return r;
+}
+
+static void bench_run(Bench *b) {
+  Bench_Result *r = bench_result(b->name);
+
+  for (int run = 0; run < bench_runs; ++run) {
+    Bench_Timer t;
+    memset(&t, 0, sizeof(t));
+
+    bench_context_create(b->l2_mshrs);
+    b->fn(&t, b->arg);
+    bench_context_free();
+
+    double ns = t.elapsed * 1e9 / t.ops;
+    if (run == 0 || ns < r->ns_per_op) {
+      r->ns_per_op = ns;
+      r->ops = t.ops;
+    }
+  }
+}
+
+/* the whole pipeline on a program, for up to bench_max_cycles cycles; an op
+ * is a cycle */
+static void bench_run_program(char *program) {
+  char name[BENCH_NAME_SIZE];
+  const char *base = strrchr(program, '/');
+
+  snprintf(name, sizeof(name), "pipe_cycle/%s", base ? base + 1 : program);
+  Bench_Result *r = bench_result(name);
+
+  for (int run = 0; run < bench_runs; ++run) {
+    Sim_Options o;
+    Bench_Timer t;
+
+    memset(&o, 0, sizeof(o));
+    o.program_files = &program;
+    o.num_program_files = 1;
+    memset(&t, 0, sizeof(t));
+
+    sim_context_bind(sim_context_create(bench_null));
+    if (!start_simulation(&o)) {
+      printf("Error: Can't load %s\n", program);
+      exit(1);
+    }
+
+    bench_start(&t);
+    while (sim->RUN_BIT && sim->stat_cycles < bench_max_cycles)
+      cycle();
+    bench_stop(&t, sim->stat_cycles);
+
+    double ns = t.elapsed * 1e9 / t.ops;
+    if (run == 0 || ns < r->ns_per_op) {
+      r->ns_per_op = ns;
+      r->ops = t.ops;
+      r->kips = sim->stat_inst_retire / t.elapsed / 1e3;
+    }
+    bench_context_free();
+  }
+}
+
+/******************************************************************************/
+/* results                                                                    */
+/******************************************************************************/
+
+/* ns/op of name in a file written by -o, 0 if it isn't there */
+static double bench_baseline(const char *filename, const char *name) {
+  char line[256], found[BENCH_NAME_SIZE];
+  double ns, result = 0;
+
+  FILE *f = fopen(filename, "r");
+  if (f == NULL)
+    return 0;
+
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, " {\"name\": \"%63[^\"]\", \"ns_per_op\": %lf", found,
+               &ns) == 2 &&
+        strcmp(found, name) == 0) {
+      result = ns;
+      break;
+    }
+  }
+  fclose(f);
+  return result;
+}
+
+static void bench_print(const char *baseline) {
+  printf("%-34s %12s %14s %10s", "Benchmark", "ns/op", "ops", "KIPS");
+  if (baseline)
+    printf(" %10s", "baseline");
+  printf("\n");
+
+  for (int n = 0; n < num_results; ++n) {
+    Bench_Result *r = results + n;
+    printf("%-34s %12.2f %14llu", r->name, r->ns_per_op,
+           (unsigned long long)r->ops);
+    if (r->kips)
+      printf(" %10.0f", r->kips);
+    else
+      printf(" %10s", "");
+
+    double base = baseline ? bench_baseline(baseline, r->name) : 0;
+    if (base)
+      printf(" %+9.1f%%", (r->ns_per_op - base) / base * 100);
+    printf("\n");
+  }
+}
+
+static bool bench_write(const char *filename) {
+  FILE *f = fopen(filename, "w");
+  if (f == NULL)
+    return false;
+
+  fprintf(f, "{\n  \"min_seconds\": %g,\n  \"runs\": %d,\n", bench_min_seconds,
+          bench_runs);
+  fprintf(f, "  \"max_cycles\": %u,\n  \"benchmarks\": [\n", bench_max_cycles);
+  for (int n = 0; n < num_results; ++n) {
+    Bench_Result *r = results + n;
+    fprintf(f,
+            "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops\": %llu, "
+            "\"kips\": %.1f}%s\n",
+            r->name, r->ns_per_op, (unsigned long long)r->ops, r->kips,
+            n + 1 < num_results ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+
+  bool ok = !ferror(f);
+  return fclose(f) == 0 && ok;
+}
+
+static void usage(char *prog) {
+  printf("usage: %s [-t seconds] [-r runs] [-n cycles] [-o json] "
+         "[-b baseline] [programs]\n",
+         prog);
+  printf("  -t s    time each benchmark for at least s seconds per run\n");
+  printf("  -r n    report the best of n runs\n");
+  printf("  -n n    run the programs for at most n cycles\n");
+  printf("  -o file write the results to file as JSON\n");
+  printf("  -b file compare with the results of an earlier -o\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  char *output = NULL, *baseline = NULL;
+  int argi = 1;
+
+  while (argi < argc && argv[argi][0] == '-') {
+    if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+      bench_min_seconds = atof(argv[++argi]);
+    } else if (strcmp(argv[argi], "-r") == 0 && argi + 1 < argc) {
+      bench_runs = atoi(argv[++argi]);
+    } else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc) {
+      bench_max_cycles = strtoul(argv[++argi], NULL, 0);
+    } else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+      output = argv[++argi];
+    } else if (strcmp(argv[argi], "-b") == 0 && argi + 1 < argc) {
+      baseline = argv[++argi];
+    } else {
+      usage(argv[0]);
+    }
+    argi++;
+  }
+  if (bench_runs < 1)
+    usage(argv[0]);
+
+  bench_null = fopen("/dev/null", "w");
+
+  for (size_t n = 0; n < sizeof(benchmarks) / sizeof(benchmarks[0]); ++n)
+    bench_run(benchmarks + n);
+  for (; argi < argc; ++argi)
+    bench_run_program(argv[argi]);
+
+  bench_print(baseline);
+
+  if (output && !bench_write(output)) {
+    printf("Error: Can't write results %s\n", output);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Renders a trace written by sim -t as text, one event per line:
+ *
+ *   cycle component event address details
+ *
+ * usage: trace_decode [-T list] [-a from] [-b to] trace
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static const char *row_status_names[] = {"hit", "miss", "conflict"};
+static const char *direction_names[] = {"l2->l1", "l2->mem", "mem->l2"};
+
+static void decode_details(Trace_Record *r, char *buf, size_t size) {
+  uint32_t x = r->extra;
+
+  switch (r->event) {
+  case TRACE_L1_HIT:
+  case TRACE_L1_INSERT:
+  case TRACE_L2_HIT:
+  case TRACE_L2_INSERT:
+    snprintf(buf, size, "set %u way %u", x >> 8, x & 0xff);
+    break;
+  case TRACE_L1_MISS:
+  case TRACE_L2_MISS:
+    snprintf(buf, size, "set %u", x);
+    break;
+  case TRACE_L2_MSHR_PENDING:
+  case TRACE_L2_MSHR_ALLOC:
+  case TRACE_L2_MSHR_MERGE:
+    snprintf(buf, size, "mshr %u", x);
+    break;
+  case TRACE_MEM_REQUEST:
+  case TRACE_MEM_DONE:
+    snprintf(buf, size, "bank %u", x);
+    break;
+  case TRACE_MEM_SCHEDULE:
+    snprintf(buf, size, "bank %u row %s", x & 0xff,
+             (x >> 8) < 3 ? row_status_names[x >> 8] : "?");
+    break;
+  case TRACE_INT_SEND:
+    snprintf(buf, size, "%s in %u cycles",
+             (x >> 16) < 3 ? direction_names[x >> 16] : "?", x & 0xffff);
+    break;
+  case TRACE_INT_DELIVER:
+    snprintf(buf, size, "%s", x < 3 ? direction_names[x] : "?");
+    break;
+  default:
+    buf[0] = '\0';
+  }
+}
+
+static void usage(char *prog) {
+  printf("usage: %s [-T list] [-a from] [-b to] trace\n", prog);
+  printf("  -T list only these components (l1i,l1d,l1,l2,mem,int)\n");
+  printf("  -a n    only events from cycle n on\n");
+  printf("  -b n    only events up to cycle n\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t components = (1u << TRACE_NUM_COMPONENTS) - 1;
+  uint32_t from = 0, to = UINT32_MAX;
+  Trace_Header h;
+  Trace_Record r;
+  char details[64];
+  int argi = 1;
+
+  while (argi < argc && argv[argi][0] == '-') {
+    if (strcmp(argv[argi], "-T") == 0 && argi + 1 < argc) {
+      if (!trace_parse_components(argv[++argi], &components))
+        usage(argv[0]);
+    } else if (strcmp(argv[argi], "-a") == 0 && argi + 1 < argc) {
+      from = strtoul(argv[++argi], NULL, 0);
+    } else if (strcmp(argv[argi], "-b") == 0 && argi + 1 < argc) {
+      to = strtoul(argv[++argi], NULL, 0);
+    } else {
+      usage(argv[0]);
+    }
+    argi++;
+  }
+  if (argi + 1 != argc)
+    usage(argv[0]);
+
+  FILE *f = fopen(argv[argi], "rb");
+  if (f == NULL) {
+    printf("Error: Can't open trace %s\n", argv[argi]);
+    return 1;
+  }
+
+  if (fread(&h, sizeof(h), 1, f) != 1 ||
+      memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0 ||
+      h.version != TRACE_VERSION || h.record_size != sizeof(Trace_Record)) {
+    printf("Error: %s is not a trace of this simulator version\n",
+           argv[argi]);
+    return 1;
+  }
+
+  while (fread(&r, sizeof(r), 1, f) == 1) {
+    if (r.cycle < from || r.cycle > to || r.component >= TRACE_NUM_COMPONENTS ||
+        r.event >= TRACE_NUM_EVENTS || !(components & (1u << r.component)))
+      continue;
+    decode_details(&r, details, sizeof(details));
+    printf("%10u %-4s %-12s 0x%08x %s\n", r.cycle,
+           trace_component_names[r.component], trace_event_names[r.event],
+           r.addr, details);
+  }
+
+  fclose(f);
+  return 0;
+}